@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Minimal STL allocator handing out storage aligned for SIMD loads.
+template <typename T, size_t Alignment = 32>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+#ifdef _WIN32
+        void* ptr = _aligned_malloc(count * sizeof(T), Alignment);
+#else
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, Alignment, count * sizeof(T)) != 0) {
+            ptr = nullptr;
+        }
+#endif
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -2,3 +2,6 @@
 
 #define BUILD_ENABLE_VULKAN_DEBUG 1
 #define BUILD_ENABLE_VULKAN_RUNTIME_DEBUG 1
+#define BUILD_ENABLE_VULKAN_HOST_ALLOCATOR 1
+#define BUILD_ENABLE_COMMAND_ENCODER_STATISTICS 1
+#define BUILD_ENABLE_BINDLESS 1
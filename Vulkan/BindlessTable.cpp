@@ -0,0 +1,231 @@
+#include "stdafx.h"
+#include "BindlessTable.h"
+#include "DeletionQueue.h"
+#include "HostAllocator.h"
+#include "Renderer.h"
+#include "Shared.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdlib>
+
+SlotAllocator::SlotAllocator(uint32_t capacity) {
+    mCapacity = capacity;
+}
+
+uint32_t SlotAllocator::allocate() {
+    if (!mFreeSlots.empty()) {
+        uint32_t slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        return slot;
+    }
+    if (mNextUnused < mCapacity) {
+        return mNextUnused++;
+    }
+    return INVALID_BINDLESS_SLOT;
+}
+
+void SlotAllocator::free(uint32_t slot) {
+    assert(slot < mNextUnused);
+    mFreeSlots.push_back(slot);
+}
+
+uint32_t SlotAllocator::getCapacity() const {
+    return mCapacity;
+}
+
+uint32_t SlotAllocator::getUsedCount() const {
+    return mNextUnused - uint32_t(mFreeSlots.size());
+}
+
+BindlessTable::BindlessTable(Renderer* renderer, uint32_t maxBuffers, uint32_t maxImages) {
+    mRenderer = renderer;
+
+#ifdef VK_EXT_descriptor_indexing
+    VkDevice device = mRenderer->getDevice();
+
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2KHR properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties.pNext = &indexingProperties;
+    mRenderer->getDispatch().vkGetPhysicalDeviceProperties2KHR(mRenderer->getPhysicalDevice(), &properties);
+
+    maxBuffers = std::min(maxBuffers, std::min(indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                                               indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers));
+    maxImages = std::min(maxImages, std::min(indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                             indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages));
+    // Both bindings are visible to every stage, so together they must fit the
+    // per stage resource limit. Split it in proportion to what was asked for.
+    uint32_t resourceLimit = indexingProperties.maxPerStageUpdateAfterBindResources;
+    if (uint64_t(maxBuffers) + maxImages > resourceLimit) {
+        uint32_t buffers = uint32_t(uint64_t(resourceLimit) * maxBuffers / (uint64_t(maxBuffers) + maxImages));
+        maxImages = resourceLimit - buffers;
+        maxBuffers = buffers;
+    }
+    mBufferSlots = SlotAllocator(maxBuffers);
+    mImageSlots = SlotAllocator(maxImages);
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    bindings[0].binding = BUFFER_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].descriptorCount = maxBuffers;
+    bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+    bindings[1].binding = IMAGE_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[1].descriptorCount = maxImages;
+    bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+    // Slots can be written while the set is bound by frames in flight, and
+    // slots nobody uses don't have to hold a valid descriptor. Without
+    // UPDATE_UNUSED_WHILE_PENDING a set can only be updated once the command
+    // buffers using it have finished, even for slots they never read.
+    VkDescriptorBindingFlagsEXT bindingFlags[2];
+    bindingFlags[0] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+                      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+                      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    bindingFlags[1] = bindingFlags[0];
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo{};
+    bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsCreateInfo.bindingCount = 2;
+    bindingFlagsCreateInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+    setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+    setLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    setLayoutCreateInfo.bindingCount = 2;
+    setLayoutCreateInfo.pBindings = bindings;
+    errorCheck(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT), &mDescriptorSetLayout));
+
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = maxBuffers;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    poolSizes[1].descriptorCount = maxImages;
+    VkDescriptorPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolCreateInfo.maxSets = 1;
+    poolCreateInfo.poolSizeCount = 2;
+    poolCreateInfo.pPoolSizes = poolSizes;
+    errorCheck(vkCreateDescriptorPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT), &mDescriptorPool));
+
+    VkDescriptorSetAllocateInfo setAllocateInfo{};
+    setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocateInfo.descriptorPool = mDescriptorPool;
+    setAllocateInfo.descriptorSetCount = 1;
+    setAllocateInfo.pSetLayouts = &mDescriptorSetLayout;
+    errorCheck(vkAllocateDescriptorSets(device, &setAllocateInfo, &mDescriptorSet));
+#else
+    assert(0 && "Bindless table requires VK_EXT_descriptor_indexing");
+    std::exit(-1);
+#endif
+}
+
+BindlessTable::~BindlessTable() {
+    // Pending slot releases point back at this table.
+    mRenderer->getDeletionQueue().flush();
+
+    VkDevice device = mRenderer->getDevice();
+    vkDestroyDescriptorPool(device, mDescriptorPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT));
+    vkDestroyDescriptorSetLayout(device, mDescriptorSetLayout, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT));
+}
+
+uint32_t BindlessTable::addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint32_t slot = mBufferSlots.allocate();
+    if (slot != INVALID_BINDLESS_SLOT) {
+        writeBuffer(slot, buffer, offset, range);
+    }
+    return slot;
+}
+
+uint32_t BindlessTable::addImage(VkImageView imageView, VkImageLayout layout) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint32_t slot = mImageSlots.allocate();
+    if (slot != INVALID_BINDLESS_SLOT) {
+        writeImage(slot, imageView, layout);
+    }
+    return slot;
+}
+
+uint32_t BindlessTable::updateBuffer(uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    // Rewriting the slot in place would change what already submitted frames read.
+    uint32_t newSlot = addBuffer(buffer, offset, range);
+    if (newSlot != INVALID_BINDLESS_SLOT) {
+        removeBuffer(slot);
+    }
+    return newSlot;
+}
+
+uint32_t BindlessTable::updateImage(uint32_t slot, VkImageView imageView, VkImageLayout layout) {
+    uint32_t newSlot = addImage(imageView, layout);
+    if (newSlot != INVALID_BINDLESS_SLOT) {
+        removeImage(slot);
+    }
+    return newSlot;
+}
+
+void BindlessTable::removeBuffer(uint32_t slot) {
+    mRenderer->getDeletionQueue().retire([this, slot] {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBufferSlots.free(slot);
+    });
+}
+
+void BindlessTable::removeImage(uint32_t slot) {
+    mRenderer->getDeletionQueue().retire([this, slot] {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mImageSlots.free(slot);
+    });
+}
+
+VkDescriptorSetLayout BindlessTable::getDescriptorSetLayout() const {
+    return mDescriptorSetLayout;
+}
+
+VkDescriptorSet BindlessTable::getDescriptorSet() const {
+    return mDescriptorSet;
+}
+
+uint32_t BindlessTable::getBufferCapacity() const {
+    return mBufferSlots.getCapacity();
+}
+
+uint32_t BindlessTable::getImageCapacity() const {
+    return mImageSlots.getCapacity();
+}
+
+void BindlessTable::writeBuffer(uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = offset;
+    bufferInfo.range = range;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = mDescriptorSet;
+    write.dstBinding = BUFFER_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    mRenderer->getDispatch().vkUpdateDescriptorSets(mRenderer->getDevice(), 1, &write, 0, nullptr);
+}
+
+void BindlessTable::writeImage(uint32_t slot, VkImageView imageView, VkImageLayout layout) {
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = imageView;
+    imageInfo.imageLayout = layout;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = mDescriptorSet;
+    write.dstBinding = IMAGE_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write.pImageInfo = &imageInfo;
+    mRenderer->getDispatch().vkUpdateDescriptorSets(mRenderer->getDevice(), 1, &write, 0, nullptr);
+}
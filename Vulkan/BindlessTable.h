@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class Renderer;
+
+static const uint32_t INVALID_BINDLESS_SLOT = UINT32_MAX;
+
+// Hands out indices in [0, capacity). Freed indices are reused last in,
+// first out so the live range of a table stays compact.
+class SlotAllocator {
+public:
+    explicit SlotAllocator(uint32_t capacity = 0);
+
+    // Returns INVALID_BINDLESS_SLOT when every slot is in use.
+    uint32_t allocate();
+    void free(uint32_t slot);
+
+    uint32_t getCapacity() const;
+    uint32_t getUsedCount() const;
+
+private:
+    uint32_t mCapacity = 0;
+    uint32_t mNextUnused = 0;
+    std::vector<uint32_t> mFreeSlots;
+};
+
+// One descriptor set holding every storage buffer and sampled image of the
+// scene in large update-after-bind arrays (VK_EXT_descriptor_indexing). It's
+// bound once at set 0 and shaders index the arrays with slots passed through
+// push constants or instance data, so draws using different materials can
+// share a batch. Shaders see:
+//   layout(set = 0, binding = 0) buffer Buffers { ... } buffers[];
+//   layout(set = 0, binding = 1) uniform texture2D images[];
+// Only created by the renderer when the device supports the required
+// descriptor indexing features; see Renderer::getBindlessTable().
+class BindlessTable {
+public:
+    static const uint32_t BUFFER_BINDING = 0;
+    static const uint32_t IMAGE_BINDING = 1;
+
+    // Capacities are clamped to the device's update-after-bind limits.
+    BindlessTable(Renderer* renderer, uint32_t maxBuffers = 65536, uint32_t maxImages = 65536);
+    // Destroyed by the renderer once the GPU is idle.
+    ~BindlessTable();
+
+    BindlessTable(const BindlessTable&) = delete;
+    BindlessTable& operator=(const BindlessTable&) = delete;
+
+    // Safe from any thread. Returns INVALID_BINDLESS_SLOT when the table is full.
+    uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    uint32_t addImage(VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Moves a resource to a new slot and removes the old one, so frames in
+    // flight keep reading the descriptor they were recorded with. Returns the
+    // new slot, or INVALID_BINDLESS_SLOT with the old slot untouched when the
+    // table is full.
+    uint32_t updateBuffer(uint32_t slot, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    uint32_t updateImage(uint32_t slot, VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Slots are reused once the frames in flight that may read them are done.
+    void removeBuffer(uint32_t slot);
+    void removeImage(uint32_t slot);
+
+    // Put at set 0 of the pipeline layouts of bindless pipelines.
+    VkDescriptorSetLayout getDescriptorSetLayout() const;
+    VkDescriptorSet getDescriptorSet() const;
+    uint32_t getBufferCapacity() const;
+    uint32_t getImageCapacity() const;
+
+private:
+    void writeBuffer(uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+    void writeImage(uint32_t slot, VkImageView imageView, VkImageLayout layout);
+
+    Renderer* mRenderer = nullptr;
+    VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet mDescriptorSet = VK_NULL_HANDLE;
+
+    // Guards the allocators and descriptor writes to mDescriptorSet.
+    std::mutex mMutex;
+    SlotAllocator mBufferSlots;
+    SlotAllocator mImageSlots;
+};
@@ -0,0 +1,141 @@
+#include "stdafx.h"
+#include "CommandCache.h"
+#include "DeletionQueue.h"
+#include "HostAllocator.h"
+#include "Renderer.h"
+#include "Shared.h"
+
+void CommandDependencies::addPipeline(VkPipeline pipeline) {
+    addValue(&pipeline, sizeof(pipeline));
+}
+
+void CommandDependencies::addBuffer(VkBuffer buffer, uint64_t contentVersion) {
+    addValue(&buffer, sizeof(buffer));
+    addValue(&contentVersion, sizeof(contentVersion));
+}
+
+void CommandDependencies::addImage(VkImage image) {
+    addValue(&image, sizeof(image));
+}
+
+void CommandDependencies::addSwapchain(VkSwapchainKHR swapchain) {
+    addValue(&swapchain, sizeof(swapchain));
+}
+
+void CommandDependencies::addViewport(const VkViewport& viewport) {
+    addValue(&viewport, sizeof(viewport));
+}
+
+void CommandDependencies::addScissor(const VkRect2D& scissor) {
+    addValue(&scissor, sizeof(scissor));
+}
+
+void CommandDependencies::addValue(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    mData.insert(mData.end(), bytes, bytes + size);
+}
+
+bool CommandDependencies::operator==(const CommandDependencies& other) const {
+    return mData == other.mData;
+}
+
+bool CommandDependencies::operator!=(const CommandDependencies& other) const {
+    return mData != other.mData;
+}
+
+CommandCache::CommandCache(Renderer* renderer) {
+    mRenderer = renderer;
+
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = mRenderer->getGraphicsQueueFamilyIndex();
+    errorCheck(vkCreateCommandPool(mRenderer->getDevice(), &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &mCommandPool));
+}
+
+CommandCache::~CommandCache() {
+    // Retired after the buffers freed earlier, and destroying the pool frees
+    // the ones still cached.
+    VkDevice device = mRenderer->getDevice();
+    VkCommandPool commandPool = mCommandPool;
+    mRenderer->getDeletionQueue().retire([device, commandPool] {
+        vkDestroyCommandPool(device, commandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+    });
+}
+
+VkCommandBuffer CommandCache::getCommandBuffer(uint32_t key, const CommandDependencies& dependencies,
+                                               const std::function<void(VkCommandBuffer)>& record) {
+    Entry& entry = mEntries[key];
+    if (entry.commandBuffer != VK_NULL_HANDLE && entry.dependencies == dependencies) {
+        mStatistics.reused++;
+        return entry.commandBuffer;
+    }
+
+    // The old buffer may be pending in a frame in flight, so record a new one
+    // rather than resetting it.
+    if (entry.commandBuffer != VK_NULL_HANDLE) {
+        retire(entry.commandBuffer);
+        entry.commandBuffer = VK_NULL_HANDLE;
+    }
+
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+    std::lock_guard<std::mutex> poolLock(*mPoolMutex);
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = mCommandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocateInfo.commandBufferCount = 1;
+    errorCheck(dispatch.vkAllocateCommandBuffers(mRenderer->getDevice(), &allocateInfo, &entry.commandBuffer));
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+    // Simultaneous use: the same buffer is executed by every frame in flight.
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    errorCheck(dispatch.vkBeginCommandBuffer(entry.commandBuffer, &beginInfo));
+    record(entry.commandBuffer);
+    errorCheck(dispatch.vkEndCommandBuffer(entry.commandBuffer));
+
+    entry.dependencies = dependencies;
+    mStatistics.recorded++;
+    return entry.commandBuffer;
+}
+
+void CommandCache::invalidate(uint32_t key) {
+    auto it = mEntries.find(key);
+    if (it == mEntries.end()) {
+        return;
+    }
+    retire(it->second.commandBuffer);
+    mEntries.erase(it);
+}
+
+void CommandCache::clear() {
+    for (auto& entry : mEntries) {
+        retire(entry.second.commandBuffer);
+    }
+    mEntries.clear();
+}
+
+const CommandCache::Statistics& CommandCache::getStatistics() const {
+    return mStatistics;
+}
+
+void CommandCache::retire(VkCommandBuffer commandBuffer) {
+    if (commandBuffer == VK_NULL_HANDLE) {
+        return;
+    }
+    // Collected on whichever thread completes a submit, possibly while the
+    // recording thread allocates from the same pool.
+    const VulkanDispatch* dispatch = &mRenderer->getDispatch();
+    VkDevice device = mRenderer->getDevice();
+    VkCommandPool commandPool = mCommandPool;
+    std::shared_ptr<std::mutex> poolMutex = mPoolMutex;
+    mRenderer->getDeletionQueue().retire([dispatch, device, commandPool, commandBuffer, poolMutex] {
+        std::lock_guard<std::mutex> poolLock(*poolMutex);
+        dispatch->vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    });
+}
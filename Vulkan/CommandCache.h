@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Renderer;
+
+// Everything a cached command buffer was recorded from. Two sets of
+// dependencies are equal when the same values were added in the same order.
+class CommandDependencies {
+public:
+    void addPipeline(VkPipeline pipeline);
+    // contentVersion is bumped by the owner whenever the contents change.
+    void addBuffer(VkBuffer buffer, uint64_t contentVersion = 0);
+    void addImage(VkImage image);
+    void addSwapchain(VkSwapchainKHR swapchain);
+    void addViewport(const VkViewport& viewport);
+    void addScissor(const VkRect2D& scissor);
+    void addValue(const void* data, size_t size);
+
+    bool operator==(const CommandDependencies& other) const;
+    bool operator!=(const CommandDependencies& other) const;
+
+private:
+    std::vector<uint8_t> mData;
+};
+
+// Secondary command buffers recorded once and re-executed every frame until
+// one of their dependencies changes. Replaced buffers are freed through the
+// deletion queue since frames in flight may still execute them. Only use a
+// cache from the thread recording frames; the deletion queue may free its
+// buffers from other threads, which is why the pool has a mutex.
+class CommandCache {
+public:
+    CommandCache(Renderer* renderer);
+    ~CommandCache();
+
+    CommandCache(const CommandCache&) = delete;
+    CommandCache& operator=(const CommandCache&) = delete;
+
+    // Returns the secondary command buffer cached under key, calling record
+    // to re-record it when dependencies differ from the last recording. The
+    // buffer is recorded outside of any render pass and can be executed by
+    // several frames in flight at once.
+    VkCommandBuffer getCommandBuffer(uint32_t key, const CommandDependencies& dependencies,
+                                     const std::function<void(VkCommandBuffer)>& record);
+
+    void invalidate(uint32_t key);
+    void clear();
+
+    struct Statistics {
+        uint64_t reused = 0;
+        uint64_t recorded = 0;
+    };
+    const Statistics& getStatistics() const;
+
+private:
+    struct Entry {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        CommandDependencies dependencies;
+    };
+
+    void retire(VkCommandBuffer commandBuffer);
+
+    Renderer* mRenderer = nullptr;
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    // Shared with the retired buffers, which can be freed after the cache is gone.
+    std::shared_ptr<std::mutex> mPoolMutex = std::make_shared<std::mutex>();
+    std::unordered_map<uint32_t, Entry> mEntries;
+    Statistics mStatistics;
+};
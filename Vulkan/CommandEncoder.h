@@ -0,0 +1,298 @@
+#pragma once
+
+#include "Platform.h"
+#include "BUILD_OPTIONS.h"
+#include "VulkanDispatch.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Pass types the encoder is specialized for. They select the bind point at
+// compile time and which state is shadowed; recording a draw in a compute
+// pass (or a dispatch in a graphics pass) doesn't compile.
+struct GraphicsPass {
+    static const VkPipelineBindPoint BIND_POINT = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    static const bool IS_GRAPHICS = true;
+};
+
+struct ComputePass {
+    static const VkPipelineBindPoint BIND_POINT = VK_PIPELINE_BIND_POINT_COMPUTE;
+    static const bool IS_GRAPHICS = false;
+};
+
+struct CommandEncoderStatistics {
+    uint32_t commandsRecorded = 0;
+    uint32_t pipelineBindsSkipped = 0;
+    uint32_t descriptorBindsSkipped = 0;
+    uint32_t vertexBufferBindsSkipped = 0;
+    uint32_t indexBufferBindsSkipped = 0;
+    uint32_t viewportsSkipped = 0;
+    uint32_t scissorsSkipped = 0;
+    uint32_t pushConstantsSkipped = 0;
+
+    uint32_t getCommandsSkipped() const {
+        return pipelineBindsSkipped + descriptorBindsSkipped + vertexBufferBindsSkipped + indexBufferBindsSkipped +
+            viewportsSkipped + scissorsSkipped + pushConstantsSkipped;
+    }
+};
+
+// State only a given pass type can bind. Compute encoders carry none of it.
+template <typename Pass>
+struct CommandEncoderPassState {
+    void invalidate() {}
+};
+
+template <>
+struct CommandEncoderPassState<GraphicsPass> {
+    static const uint32_t MAX_VERTEX_BINDINGS = 8;
+
+    VkBuffer vertexBuffers[MAX_VERTEX_BINDINGS];
+    VkDeviceSize vertexOffsets[MAX_VERTEX_BINDINGS];
+    VkBuffer indexBuffer;
+    VkDeviceSize indexOffset;
+    VkIndexType indexType;
+    VkViewport viewport;
+    VkRect2D scissor;
+    bool viewportValid;
+    bool scissorValid;
+
+    void invalidate() {
+        for (uint32_t i = 0; i < MAX_VERTEX_BINDINGS; i++) {
+            vertexBuffers[i] = VK_NULL_HANDLE;
+            vertexOffsets[i] = 0;
+        }
+        indexBuffer = VK_NULL_HANDLE;
+        indexOffset = 0;
+        indexType = VK_INDEX_TYPE_UINT16;
+        viewportValid = false;
+        scissorValid = false;
+    }
+};
+
+// Thin wrapper around a VkCommandBuffer that shadows bound state and drops
+// commands that wouldn't change it. Everything is inline so a filtered call
+// costs a compare; recorded calls go straight to the driver through the
+// device dispatch table. Skipped commands are only counted when
+// CountStatistics is set, which defaults to BUILD_ENABLE_COMMAND_ENCODER_STATISTICS.
+//
+// Call invalidate() after recording anything that changes state behind the
+// encoder's back (raw vkCmd* calls on getCommandBuffer(), secondary command
+// buffers) so the next bind is recorded again.
+template <typename Pass, bool CountStatistics = BUILD_ENABLE_COMMAND_ENCODER_STATISTICS != 0>
+class CommandEncoder {
+public:
+    static const uint32_t MAX_DESCRIPTOR_SETS = 4;
+    // Minimum maxPushConstantsSize guaranteed by the spec.
+    static const uint32_t MAX_PUSH_CONSTANT_SIZE = 128;
+
+    // dispatch must be loaded from the device owning commandBuffer.
+    CommandEncoder(const VulkanDispatch& dispatch, VkCommandBuffer commandBuffer) {
+        mDispatch = &dispatch;
+        mCommandBuffer = commandBuffer;
+        invalidate();
+    }
+
+    VkCommandBuffer getCommandBuffer() const {
+        return mCommandBuffer;
+    }
+
+    void invalidate() {
+        mPipeline = VK_NULL_HANDLE;
+        mDescriptorLayout = VK_NULL_HANDLE;
+        for (uint32_t i = 0; i < MAX_DESCRIPTOR_SETS; i++) {
+            mDescriptorSets[i] = VK_NULL_HANDLE;
+        }
+        mPushConstantLayout = VK_NULL_HANDLE;
+        mPushConstantStages = 0;
+        memset(mPushConstantValid, 0, sizeof(mPushConstantValid));
+        mPassState.invalidate();
+    }
+
+    void bindPipeline(VkPipeline pipeline) {
+        if (mPipeline == pipeline) {
+            countSkipped(mStatistics.pipelineBindsSkipped);
+            return;
+        }
+        mDispatch->vkCmdBindPipeline(mCommandBuffer, Pass::BIND_POINT, pipeline);
+        mPipeline = pipeline;
+        countRecorded();
+    }
+
+    // Sets with dynamic offsets are always recorded.
+    void bindDescriptorSets(VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const VkDescriptorSet* sets,
+                            uint32_t dynamicOffsetCount = 0, const uint32_t* dynamicOffsets = nullptr) {
+        // A different layout may disturb the bound sets, so forget them.
+        if (mDescriptorLayout != layout) {
+            mDescriptorLayout = layout;
+            for (uint32_t i = 0; i < MAX_DESCRIPTOR_SETS; i++) {
+                mDescriptorSets[i] = VK_NULL_HANDLE;
+            }
+        }
+
+        bool redundant = dynamicOffsetCount == 0 && firstSet + setCount <= MAX_DESCRIPTOR_SETS;
+        for (uint32_t i = 0; redundant && i < setCount; i++) {
+            redundant = mDescriptorSets[firstSet + i] == sets[i];
+        }
+        if (redundant) {
+            countSkipped(mStatistics.descriptorBindsSkipped);
+            return;
+        }
+
+        mDispatch->vkCmdBindDescriptorSets(mCommandBuffer, Pass::BIND_POINT, layout, firstSet, setCount, sets, dynamicOffsetCount, dynamicOffsets);
+        for (uint32_t i = 0; i < setCount && firstSet + i < MAX_DESCRIPTOR_SETS; i++) {
+            mDescriptorSets[firstSet + i] = dynamicOffsetCount == 0 ? sets[i] : VK_NULL_HANDLE;
+        }
+        countRecorded();
+    }
+
+    void bindDescriptorSet(VkPipelineLayout layout, uint32_t set, VkDescriptorSet descriptorSet) {
+        bindDescriptorSets(layout, set, 1, &descriptorSet);
+    }
+
+    void pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data) {
+        if (mPushConstantLayout != layout || mPushConstantStages != stages) {
+            mPushConstantLayout = layout;
+            mPushConstantStages = stages;
+            memset(mPushConstantValid, 0, sizeof(mPushConstantValid));
+        }
+
+        bool shadowed = offset + size <= MAX_PUSH_CONSTANT_SIZE;
+        if (shadowed && isPushConstantRangeValid(offset, size) && memcmp(mPushConstants + offset, data, size) == 0) {
+            countSkipped(mStatistics.pushConstantsSkipped);
+            return;
+        }
+
+        mDispatch->vkCmdPushConstants(mCommandBuffer, layout, stages, offset, size, data);
+        if (shadowed) {
+            memcpy(mPushConstants + offset, data, size);
+            memset(mPushConstantValid + offset, 1, size);
+        }
+        countRecorded();
+    }
+
+    void bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets) {
+        static_assert(Pass::IS_GRAPHICS, "Vertex buffers can only be bound in a graphics pass");
+        const uint32_t maxBindings = CommandEncoderPassState<GraphicsPass>::MAX_VERTEX_BINDINGS;
+
+        bool redundant = firstBinding + bindingCount <= maxBindings;
+        for (uint32_t i = 0; redundant && i < bindingCount; i++) {
+            redundant = mPassState.vertexBuffers[firstBinding + i] == buffers[i] && mPassState.vertexOffsets[firstBinding + i] == offsets[i];
+        }
+        if (redundant) {
+            countSkipped(mStatistics.vertexBufferBindsSkipped);
+            return;
+        }
+
+        mDispatch->vkCmdBindVertexBuffers(mCommandBuffer, firstBinding, bindingCount, buffers, offsets);
+        for (uint32_t i = 0; i < bindingCount && firstBinding + i < maxBindings; i++) {
+            mPassState.vertexBuffers[firstBinding + i] = buffers[i];
+            mPassState.vertexOffsets[firstBinding + i] = offsets[i];
+        }
+        countRecorded();
+    }
+
+    void bindVertexBuffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset = 0) {
+        bindVertexBuffers(binding, 1, &buffer, &offset);
+    }
+
+    void bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType) {
+        static_assert(Pass::IS_GRAPHICS, "Index buffers can only be bound in a graphics pass");
+        if (mPassState.indexBuffer == buffer && mPassState.indexOffset == offset && mPassState.indexType == indexType) {
+            countSkipped(mStatistics.indexBufferBindsSkipped);
+            return;
+        }
+        mDispatch->vkCmdBindIndexBuffer(mCommandBuffer, buffer, offset, indexType);
+        mPassState.indexBuffer = buffer;
+        mPassState.indexOffset = offset;
+        mPassState.indexType = indexType;
+        countRecorded();
+    }
+
+    void setViewport(const VkViewport& viewport) {
+        static_assert(Pass::IS_GRAPHICS, "Viewports can only be set in a graphics pass");
+        if (mPassState.viewportValid && memcmp(&mPassState.viewport, &viewport, sizeof(viewport)) == 0) {
+            countSkipped(mStatistics.viewportsSkipped);
+            return;
+        }
+        mDispatch->vkCmdSetViewport(mCommandBuffer, 0, 1, &viewport);
+        mPassState.viewport = viewport;
+        mPassState.viewportValid = true;
+        countRecorded();
+    }
+
+    void setScissor(const VkRect2D& scissor) {
+        static_assert(Pass::IS_GRAPHICS, "Scissors can only be set in a graphics pass");
+        if (mPassState.scissorValid && memcmp(&mPassState.scissor, &scissor, sizeof(scissor)) == 0) {
+            countSkipped(mStatistics.scissorsSkipped);
+            return;
+        }
+        mDispatch->vkCmdSetScissor(mCommandBuffer, 0, 1, &scissor);
+        mPassState.scissor = scissor;
+        mPassState.scissorValid = true;
+        countRecorded();
+    }
+
+    void draw(uint32_t vertexCount, uint32_t instanceCount = 1, uint32_t firstVertex = 0, uint32_t firstInstance = 0) {
+        static_assert(Pass::IS_GRAPHICS, "Draws can only be recorded in a graphics pass");
+        mDispatch->vkCmdDraw(mCommandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+        countRecorded();
+    }
+
+    void drawIndexed(uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0, int32_t vertexOffset = 0, uint32_t firstInstance = 0) {
+        static_assert(Pass::IS_GRAPHICS, "Draws can only be recorded in a graphics pass");
+        mDispatch->vkCmdDrawIndexed(mCommandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+        countRecorded();
+    }
+
+    void dispatch(uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1) {
+        static_assert(!Pass::IS_GRAPHICS, "Dispatches can only be recorded in a compute pass");
+        mDispatch->vkCmdDispatch(mCommandBuffer, groupCountX, groupCountY, groupCountZ);
+        countRecorded();
+    }
+
+    // Always zero when statistics are compiled out.
+    const CommandEncoderStatistics& getStatistics() const {
+        return mStatistics;
+    }
+
+    void resetStatistics() {
+        mStatistics = CommandEncoderStatistics();
+    }
+
+private:
+    bool isPushConstantRangeValid(uint32_t offset, uint32_t size) const {
+        for (uint32_t i = offset; i < offset + size; i++) {
+            if (!mPushConstantValid[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void countRecorded() {
+        if (CountStatistics) {
+            mStatistics.commandsRecorded++;
+        }
+    }
+
+    void countSkipped(uint32_t& counter) {
+        if (CountStatistics) {
+            counter++;
+        }
+    }
+
+    const VulkanDispatch* mDispatch = nullptr;
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+
+    VkPipeline mPipeline;
+    VkPipelineLayout mDescriptorLayout;
+    VkDescriptorSet mDescriptorSets[MAX_DESCRIPTOR_SETS];
+
+    VkPipelineLayout mPushConstantLayout;
+    VkShaderStageFlags mPushConstantStages;
+    uint8_t mPushConstants[MAX_PUSH_CONSTANT_SIZE];
+    uint8_t mPushConstantValid[MAX_PUSH_CONSTANT_SIZE];
+
+    CommandEncoderPassState<Pass> mPassState;
+    CommandEncoderStatistics mStatistics;
+};
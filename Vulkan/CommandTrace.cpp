@@ -0,0 +1,819 @@
+#include "stdafx.h"
+#include "CommandTrace.h"
+#include "MappedBuffer.h"
+#include "MemoryBudget.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "Shared.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdio.h>
+
+namespace {
+
+const uint32_t MAX_DISPATCH_BUFFERS = 8;
+
+uint32_t checksum(const void* data, size_t size) {
+    // FNV-1a
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void fillPattern(void* data, size_t size, uint32_t seed) {
+    // xorshift32, so replays without stored uploads are still deterministic.
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    uint32_t state = seed | 1;
+    for (size_t i = 0; i < size; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        bytes[i] = uint8_t(state);
+    }
+}
+
+struct TraceReader {
+    const uint8_t* position;
+    const uint8_t* end;
+    bool valid;
+
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (position >= end) {
+                valid = false;
+                return 0;
+            }
+            uint8_t byte = *position++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        valid = false;
+        return 0;
+    }
+
+    void readBytes(std::vector<uint8_t>& bytes, uint64_t size) {
+        if (uint64_t(end - position) < size) {
+            valid = false;
+            return;
+        }
+        bytes.insert(bytes.end(), position, position + size);
+        position += size;
+    }
+};
+
+double elapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+void CommandTrace::setStoreUploadData(bool storeUploadData) {
+    mStoreUploadData = storeUploadData;
+}
+
+uint32_t CommandTrace::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage) {
+    writeOp(TraceOp::CreateBuffer);
+    writeVarint(mNextBufferId);
+    writeVarint(size);
+    writeVarint(usage);
+    return mNextBufferId++;
+}
+
+uint32_t CommandTrace::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage) {
+    writeOp(TraceOp::CreateImage);
+    writeVarint(mNextImageId);
+    writeVarint(width);
+    writeVarint(height);
+    writeVarint(uint32_t(format));
+    writeVarint(usage);
+    return mNextImageId++;
+}
+
+void CommandTrace::uploadBuffer(uint32_t buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+    writeOp(TraceOp::UploadBuffer);
+    writeVarint(buffer);
+    writeVarint(offset);
+    writeVarint(size);
+    writeVarint(mStoreUploadData ? 1 : 0);
+    writeVarint(checksum(data, size_t(size)));
+    if (mStoreUploadData) {
+        writeBytes(data, size_t(size));
+    }
+}
+
+uint32_t CommandTrace::createComputePipeline(const std::vector<uint32_t>& spirv, uint32_t bufferCount, uint32_t pushConstantSize) {
+    writeOp(TraceOp::CreateComputePipeline);
+    writeVarint(mNextPipelineId);
+    writeVarint(bufferCount);
+    writeVarint(pushConstantSize);
+    writeVarint(spirv.size());
+    writeBytes(spirv.data(), spirv.size() * sizeof(uint32_t));
+    return mNextPipelineId++;
+}
+
+void CommandTrace::beginPass(const std::string& name) {
+    writeOp(TraceOp::BeginPass);
+    writeVarint(name.size());
+    writeBytes(name.data(), name.size());
+}
+
+void CommandTrace::endPass() {
+    writeOp(TraceOp::EndPass);
+}
+
+void CommandTrace::clearImage(uint32_t image, const float color[4]) {
+    writeOp(TraceOp::ClearImage);
+    writeVarint(image);
+    for (uint32_t i = 0; i < 4; i++) {
+        writeFloat(color[i]);
+    }
+}
+
+void CommandTrace::copyBuffer(uint32_t source, uint32_t destination, VkDeviceSize sourceOffset, VkDeviceSize destinationOffset, VkDeviceSize size) {
+    writeOp(TraceOp::CopyBuffer);
+    writeVarint(source);
+    writeVarint(destination);
+    writeVarint(sourceOffset);
+    writeVarint(destinationOffset);
+    writeVarint(size);
+}
+
+void CommandTrace::dispatch(uint32_t pipeline, const std::vector<uint32_t>& buffers, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                            const void* pushConstants, uint32_t pushConstantSize) {
+    writeOp(TraceOp::Dispatch);
+    writeVarint(pipeline);
+    writeVarint(buffers.size());
+    for (auto buffer : buffers) {
+        writeVarint(buffer);
+    }
+    writeVarint(groupCountX);
+    writeVarint(groupCountY);
+    writeVarint(groupCountZ);
+    writeVarint(pushConstantSize);
+    writeBytes(pushConstants, pushConstantSize);
+}
+
+void CommandTrace::endFrame() {
+    writeOp(TraceOp::EndFrame);
+}
+
+bool CommandTrace::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    uint32_t header[2] = { MAGIC, VERSION };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mData.data()), mData.size());
+    return bool(file);
+}
+
+bool CommandTrace::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+
+    size_t size = size_t(file.tellg());
+    uint32_t header[2] = {};
+    if (size < sizeof(header)) {
+        return false;
+    }
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (header[0] != MAGIC || header[1] != VERSION) {
+        return false;
+    }
+
+    clear();
+    mData.resize(size - sizeof(header));
+    file.read(reinterpret_cast<char*>(mData.data()), mData.size());
+    return bool(file);
+}
+
+void CommandTrace::clear() {
+    mData.clear();
+    mNextBufferId = 0;
+    mNextImageId = 0;
+    mNextPipelineId = 0;
+}
+
+const std::vector<uint8_t>& CommandTrace::getData() const {
+    return mData;
+}
+
+void CommandTrace::writeOp(TraceOp op) {
+    mData.push_back(uint8_t(op));
+}
+
+void CommandTrace::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        mData.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    mData.push_back(uint8_t(value));
+}
+
+void CommandTrace::writeFloat(float value) {
+    writeBytes(&value, sizeof(value));
+}
+
+void CommandTrace::writeBytes(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    mData.insert(mData.end(), bytes, bytes + size);
+}
+
+TraceReplayer::TraceReplayer(Renderer* renderer) {
+    mRenderer = renderer;
+
+    const VkPhysicalDeviceProperties& properties = mRenderer->getPhysicalDeviceProperties();
+    mTimestampsSupported = properties.limits.timestampComputeAndGraphics == VK_TRUE && properties.limits.timestampPeriod > 0.0f;
+
+    VkDevice device = mRenderer->getDevice();
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = mRenderer->getGraphicsQueueFamilyIndex();
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    errorCheck(vkCreateCommandPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &mCommandPool));
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = mCommandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    errorCheck(vkAllocateCommandBuffers(device, &allocateInfo, &mCommandBuffer));
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    errorCheck(vkCreateFence(device, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &mFence));
+}
+
+TraceReplayer::~TraceReplayer() {
+    destroyResources();
+
+    VkDevice device = mRenderer->getDevice();
+    vkDestroyFence(device, mFence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+    vkDestroyCommandPool(device, mCommandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+}
+
+bool TraceReplayer::decode(const CommandTrace& trace) {
+    const std::vector<uint8_t>& data = trace.getData();
+    TraceReader reader{ data.data(), data.data() + data.size(), true };
+
+    mSetupCommands.clear();
+    mFrameCommands.clear();
+    mPassTimings.clear();
+    // Pass 0 collects commands recorded outside of any pass.
+    mPassTimings.push_back(TracePassTiming());
+    mPassTimings[0].name = "(no pass)";
+
+    std::vector<VkDeviceSize> bufferSizes;
+    std::vector<uint32_t> pipelineBufferCounts;
+    std::vector<uint32_t> pipelinePushConstantSizes;
+    uint32_t imageCount = 0;
+    uint32_t currentPass = 0;
+
+    while (reader.valid && reader.position < reader.end) {
+        Command command;
+        command.op = TraceOp(*reader.position++);
+        command.pass = currentPass;
+
+        switch (command.op) {
+        case TraceOp::CreateBuffer:
+            for (uint32_t i = 0; i < 3; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            reader.valid = reader.valid && command.args[0] == bufferSizes.size() && command.args[1] > 0;
+            bufferSizes.push_back(command.args[1]);
+            mSetupCommands.push_back(command);
+            break;
+        case TraceOp::CreateImage:
+            for (uint32_t i = 0; i < 5; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            reader.valid = reader.valid && command.args[0] == imageCount++ && command.args[1] > 0 && command.args[2] > 0;
+            mSetupCommands.push_back(command);
+            break;
+        case TraceOp::CreateComputePipeline:
+            for (uint32_t i = 0; i < 4; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            reader.readBytes(command.bytes, command.args[3] * sizeof(uint32_t));
+            reader.valid = reader.valid && command.args[0] == pipelineBufferCounts.size() &&
+                command.args[1] <= MAX_DISPATCH_BUFFERS && command.args[2] % 4 == 0 && command.args[3] > 0;
+            pipelineBufferCounts.push_back(uint32_t(command.args[1]));
+            pipelinePushConstantSizes.push_back(uint32_t(command.args[2]));
+            mSetupCommands.push_back(command);
+            break;
+        case TraceOp::UploadBuffer:
+            for (uint32_t i = 0; i < 5; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            if (command.args[3] != 0) {
+                reader.readBytes(command.bytes, command.args[2]);
+            }
+            reader.valid = reader.valid && command.args[0] < bufferSizes.size() && command.args[2] > 0 &&
+                command.args[1] + command.args[2] <= bufferSizes[size_t(command.args[0])];
+            mFrameCommands.push_back(command);
+            break;
+        case TraceOp::BeginPass: {
+            std::vector<uint8_t> name;
+            reader.readBytes(name, reader.readVarint());
+            mPassTimings.push_back(TracePassTiming());
+            mPassTimings.back().name.assign(name.begin(), name.end());
+            currentPass = uint32_t(mPassTimings.size() - 1);
+            break;
+        }
+        case TraceOp::EndPass:
+            currentPass = 0;
+            break;
+        case TraceOp::ClearImage:
+            command.args.push_back(reader.readVarint());
+            reader.readBytes(command.bytes, 4 * sizeof(float));
+            reader.valid = reader.valid && command.args[0] < imageCount;
+            mFrameCommands.push_back(command);
+            break;
+        case TraceOp::CopyBuffer:
+            for (uint32_t i = 0; i < 5; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            reader.valid = reader.valid && command.args[0] < bufferSizes.size() && command.args[1] < bufferSizes.size() &&
+                command.args[2] + command.args[4] <= bufferSizes[size_t(command.args[0])] &&
+                command.args[3] + command.args[4] <= bufferSizes[size_t(command.args[1])];
+            mFrameCommands.push_back(command);
+            break;
+        case TraceOp::Dispatch: {
+            // pipeline, buffer count, buffers..., x, y, z, push constant size
+            command.args.push_back(reader.readVarint());
+            uint64_t bufferCount = reader.readVarint();
+            command.args.push_back(bufferCount);
+            reader.valid = reader.valid && command.args[0] < pipelineBufferCounts.size() &&
+                bufferCount == pipelineBufferCounts[size_t(command.args[0])];
+            for (uint64_t i = 0; reader.valid && i < bufferCount; i++) {
+                command.args.push_back(reader.readVarint());
+                reader.valid = reader.valid && command.args.back() < bufferSizes.size();
+            }
+            for (uint32_t i = 0; i < 4; i++) {
+                command.args.push_back(reader.readVarint());
+            }
+            // Pushed at offset 0, so the bytes must fit the pipeline's range.
+            reader.valid = reader.valid && command.args.back() % 4 == 0 &&
+                command.args.back() <= pipelinePushConstantSizes[size_t(command.args[0])];
+            reader.readBytes(command.bytes, command.args.back());
+            mFrameCommands.push_back(command);
+            break;
+        }
+        case TraceOp::EndFrame:
+            // One frame is replayed; anything after it is ignored.
+            return reader.valid;
+        default:
+            reader.valid = false;
+            break;
+        }
+    }
+    return reader.valid;
+}
+
+void TraceReplayer::createResources() {
+    VkDevice device = mRenderer->getDevice();
+    MemoryBudget& memoryBudget = mRenderer->getMemoryBudget();
+
+    uint32_t dispatchCount = 0;
+    uint32_t descriptorCount = 0;
+    for (auto& command : mFrameCommands) {
+        if (command.op == TraceOp::Dispatch) {
+            dispatchCount++;
+            descriptorCount += uint32_t(command.args[1]);
+        }
+    }
+
+    for (auto& command : mSetupCommands) {
+        if (command.op == TraceOp::CreateBuffer) {
+            Buffer buffer;
+            buffer.size = command.args[1];
+
+            VkBufferCreateInfo bufferCreateInfo{};
+            bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferCreateInfo.size = buffer.size;
+            // Replayed commands may copy, upload or bind any buffer as storage.
+            bufferCreateInfo.usage = VkBufferUsageFlags(command.args[2]) | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            errorCheck(vkCreateBuffer(device, &bufferCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT), &buffer.buffer));
+
+            VkMemoryRequirements requirements;
+            vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+            VkMemoryAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocateInfo.allocationSize = requirements.size;
+            allocateInfo.memoryTypeIndex = mRenderer->findMemoryTypeIndex(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            errorCheck(memoryBudget.allocate(allocateInfo, &buffer.memory));
+            errorCheck(vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0));
+            buffer.memoryTypeIndex = allocateInfo.memoryTypeIndex;
+            buffer.size = allocateInfo.allocationSize;
+            mBuffers.push_back(buffer);
+        } else if (command.op == TraceOp::CreateImage) {
+            Image image;
+
+            VkImageCreateInfo imageCreateInfo{};
+            imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageCreateInfo.format = VkFormat(command.args[3]);
+            imageCreateInfo.extent.width = uint32_t(command.args[1]);
+            imageCreateInfo.extent.height = uint32_t(command.args[2]);
+            imageCreateInfo.extent.depth = 1;
+            imageCreateInfo.mipLevels = 1;
+            imageCreateInfo.arrayLayers = 1;
+            imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageCreateInfo.usage = VkImageUsageFlags(command.args[4]) | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            errorCheck(vkCreateImage(device, &imageCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT), &image.image));
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device, image.image, &requirements);
+            VkMemoryAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocateInfo.allocationSize = requirements.size;
+            allocateInfo.memoryTypeIndex = mRenderer->findMemoryTypeIndex(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            errorCheck(memoryBudget.allocate(allocateInfo, &image.memory));
+            errorCheck(vkBindImageMemory(device, image.image, image.memory, 0));
+            image.memoryTypeIndex = allocateInfo.memoryTypeIndex;
+            image.size = allocateInfo.allocationSize;
+            mImages.push_back(image);
+        } else if (command.op == TraceOp::CreateComputePipeline) {
+            Pipeline pipeline;
+            pipeline.bufferCount = uint32_t(command.args[1]);
+            uint32_t pushConstantSize = uint32_t(command.args[2]);
+
+            VkShaderModuleCreateInfo moduleCreateInfo{};
+            moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            moduleCreateInfo.codeSize = command.bytes.size();
+            moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(command.bytes.data());
+            errorCheck(vkCreateShaderModule(device, &moduleCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT), &pipeline.shaderModule));
+
+            VkDescriptorSetLayoutBinding bindings[MAX_DISPATCH_BUFFERS]{};
+            for (uint32_t i = 0; i < pipeline.bufferCount; i++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+            VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+            setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            setLayoutCreateInfo.bindingCount = pipeline.bufferCount;
+            setLayoutCreateInfo.pBindings = bindings;
+            errorCheck(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT), &pipeline.descriptorSetLayout));
+
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.size = pushConstantSize;
+            VkPipelineLayoutCreateInfo layoutCreateInfo{};
+            layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            layoutCreateInfo.setLayoutCount = 1;
+            layoutCreateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+            layoutCreateInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+            layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+            errorCheck(vkCreatePipelineLayout(device, &layoutCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_LAYOUT_EXT), &pipeline.pipelineLayout));
+
+            VkComputePipelineCreateInfo pipelineCreateInfo{};
+            pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineCreateInfo.stage.module = pipeline.shaderModule;
+            pipelineCreateInfo.stage.pName = "main";
+            pipelineCreateInfo.layout = pipeline.pipelineLayout;
+            errorCheck(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT), &pipeline.pipeline));
+            mPipelines.push_back(pipeline);
+        }
+    }
+
+    if (dispatchCount > 0) {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = std::max<uint32_t>(descriptorCount, 1);
+        VkDescriptorPoolCreateInfo poolCreateInfo{};
+        poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolCreateInfo.maxSets = dispatchCount;
+        poolCreateInfo.poolSizeCount = 1;
+        poolCreateInfo.pPoolSizes = &poolSize;
+        errorCheck(vkCreateDescriptorPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT), &mDescriptorPool));
+    }
+
+    // Staging buffers and descriptor sets are prepared up front so recording
+    // only measures command recording.
+    for (auto& command : mFrameCommands) {
+        if (command.op == TraceOp::UploadBuffer) {
+            VkDeviceSize size = command.args[2];
+            MappedBuffer* staging = new MappedBuffer(mRenderer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+            if (!command.bytes.empty()) {
+                memcpy(staging->getMappedData(), command.bytes.data(), size_t(size));
+            } else {
+                fillPattern(staging->getMappedData(), size_t(size), uint32_t(command.args[4]));
+            }
+            staging->flush();
+            command.resource = uint32_t(mStagingBuffers.size());
+            mStagingBuffers.emplace_back(staging);
+        } else if (command.op == TraceOp::Dispatch) {
+            const Pipeline& pipeline = mPipelines[size_t(command.args[0])];
+
+            VkDescriptorSetAllocateInfo setAllocateInfo{};
+            setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setAllocateInfo.descriptorPool = mDescriptorPool;
+            setAllocateInfo.descriptorSetCount = 1;
+            setAllocateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            errorCheck(vkAllocateDescriptorSets(device, &setAllocateInfo, &descriptorSet));
+
+            VkDescriptorBufferInfo bufferInfos[MAX_DISPATCH_BUFFERS]{};
+            VkWriteDescriptorSet writes[MAX_DISPATCH_BUFFERS]{};
+            for (uint32_t i = 0; i < pipeline.bufferCount; i++) {
+                bufferInfos[i].buffer = mBuffers[size_t(command.args[2 + i])].buffer;
+                bufferInfos[i].range = VK_WHOLE_SIZE;
+                writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[i].dstSet = descriptorSet;
+                writes[i].dstBinding = i;
+                writes[i].descriptorCount = 1;
+                writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+            vkUpdateDescriptorSets(device, pipeline.bufferCount, writes, 0, nullptr);
+
+            command.resource = uint32_t(mDescriptorSets.size());
+            mDescriptorSets.push_back(descriptorSet);
+        }
+    }
+
+    mRuns.clear();
+    for (size_t i = 0; i < mFrameCommands.size(); i++) {
+        if (mRuns.empty() || mRuns.back().pass != mFrameCommands[i].pass) {
+            Run run;
+            run.pass = mFrameCommands[i].pass;
+            run.begin = i;
+            mRuns.push_back(run);
+        }
+        mRuns.back().end = i + 1;
+    }
+
+    // A pair of timestamps per run, added up per pass after each replay.
+    if (mTimestampsSupported && !mRuns.empty()) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo{};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = uint32_t(mRuns.size() * 2);
+        errorCheck(vkCreateQueryPool(device, &queryPoolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_QUERY_POOL_EXT), &mQueryPool));
+    }
+
+    // Clears are replayed in the general layout, which every image is moved to once.
+    if (!mImages.empty()) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        errorCheck(vkBeginCommandBuffer(mCommandBuffer, &beginInfo));
+
+        std::vector<VkImageMemoryBarrier> barriers(mImages.size());
+        for (size_t i = 0; i < mImages.size(); i++) {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = mImages[i].image;
+            barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barriers[i].subresourceRange.levelCount = 1;
+            barriers[i].subresourceRange.layerCount = 1;
+        }
+        vkCmdPipelineBarrier(mCommandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0, nullptr,
+                             0, nullptr,
+                             uint32_t(barriers.size()), barriers.data());
+        errorCheck(vkEndCommandBuffer(mCommandBuffer));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &mCommandBuffer;
+        uint64_t submitSerial;
+        {
+            std::lock_guard<std::mutex> queueLock(mRenderer->getQueueMutex());
+            submitSerial = mRenderer->beginSubmit();
+            errorCheck(vkQueueSubmit(mRenderer->getQueue(), 1, &submitInfo, mFence));
+        }
+        errorCheck(vkWaitForFences(device, 1, &mFence, VK_TRUE, UINT64_MAX));
+        errorCheck(vkResetFences(device, 1, &mFence));
+        mRenderer->completeSubmit(submitSerial);
+    }
+}
+
+void TraceReplayer::destroyResources() {
+    VkDevice device = mRenderer->getDevice();
+    MemoryBudget& memoryBudget = mRenderer->getMemoryBudget();
+
+    // Every replay waits on its fence, so nothing here is still in use.
+    for (auto& buffer : mBuffers) {
+        vkDestroyBuffer(device, buffer.buffer, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT));
+        memoryBudget.free(buffer.memory, buffer.memoryTypeIndex, buffer.size);
+    }
+    for (auto& image : mImages) {
+        vkDestroyImage(device, image.image, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT));
+        memoryBudget.free(image.memory, image.memoryTypeIndex, image.size);
+    }
+    for (auto& pipeline : mPipelines) {
+        vkDestroyPipeline(device, pipeline.pipeline, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT));
+        vkDestroyPipelineLayout(device, pipeline.pipelineLayout, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_LAYOUT_EXT));
+        vkDestroyDescriptorSetLayout(device, pipeline.descriptorSetLayout, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT));
+        vkDestroyShaderModule(device, pipeline.shaderModule, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT));
+    }
+    if (mDescriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, mDescriptorPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT));
+        mDescriptorPool = VK_NULL_HANDLE;
+    }
+    if (mQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, mQueryPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_QUERY_POOL_EXT));
+        mQueryPool = VK_NULL_HANDLE;
+    }
+
+    mBuffers.clear();
+    mImages.clear();
+    mPipelines.clear();
+    mStagingBuffers.clear();
+    mDescriptorSets.clear();
+}
+
+void TraceReplayer::recordCommand(VkCommandBuffer commandBuffer, const Command& command) {
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+
+    switch (command.op) {
+    case TraceOp::UploadBuffer: {
+        VkBufferCopy region{};
+        region.dstOffset = command.args[1];
+        region.size = command.args[2];
+        dispatch.vkCmdCopyBuffer(commandBuffer, mStagingBuffers[command.resource]->getBuffer(), mBuffers[size_t(command.args[0])].buffer, 1, &region);
+        break;
+    }
+    case TraceOp::ClearImage: {
+        VkClearColorValue color;
+        memcpy(color.float32, command.bytes.data(), sizeof(color.float32));
+        VkImageSubresourceRange range{};
+        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.levelCount = 1;
+        range.layerCount = 1;
+        dispatch.vkCmdClearColorImage(commandBuffer, mImages[size_t(command.args[0])].image, VK_IMAGE_LAYOUT_GENERAL, &color, 1, &range);
+        break;
+    }
+    case TraceOp::CopyBuffer: {
+        VkBufferCopy region{};
+        region.srcOffset = command.args[2];
+        region.dstOffset = command.args[3];
+        region.size = command.args[4];
+        dispatch.vkCmdCopyBuffer(commandBuffer, mBuffers[size_t(command.args[0])].buffer, mBuffers[size_t(command.args[1])].buffer, 1, &region);
+        break;
+    }
+    case TraceOp::Dispatch: {
+        const Pipeline& pipeline = mPipelines[size_t(command.args[0])];
+        size_t groups = 2 + size_t(command.args[1]);
+        dispatch.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+        dispatch.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipelineLayout, 0, 1, &mDescriptorSets[command.resource], 0, nullptr);
+        if (!command.bytes.empty()) {
+            dispatch.vkCmdPushConstants(commandBuffer, pipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, uint32_t(command.bytes.size()), command.bytes.data());
+        }
+        dispatch.vkCmdDispatch(commandBuffer, uint32_t(command.args[groups]), uint32_t(command.args[groups + 1]), uint32_t(command.args[groups + 2]));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool TraceReplayer::replay(const CommandTrace& trace, uint32_t iterations) {
+    destroyResources();
+    if (!decode(trace)) {
+        printf("Trace replay: malformed trace\n");
+        return false;
+    }
+
+    auto setupStart = std::chrono::steady_clock::now();
+    createResources();
+    mSetupMilliseconds = elapsedMilliseconds(setupStart);
+
+    VkDevice device = mRenderer->getDevice();
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+    bool timestamps = mQueryPool != VK_NULL_HANDLE;
+    uint32_t queryCount = uint32_t(mRuns.size() * 2);
+    std::vector<double> cpuTotals(mPassTimings.size(), 0.0);
+    std::vector<double> gpuTotals(mPassTimings.size(), 0.0);
+    std::vector<uint32_t> commandCounts(mPassTimings.size(), 0);
+    for (auto& command : mFrameCommands) {
+        commandCounts[command.pass]++;
+    }
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    std::vector<uint64_t> queryResults(queryCount, 0);
+    iterations = std::max<uint32_t>(iterations, 1);
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        errorCheck(dispatch.vkBeginCommandBuffer(mCommandBuffer, &beginInfo));
+        if (timestamps) {
+            dispatch.vkCmdResetQueryPool(mCommandBuffer, mQueryPool, 0, queryCount);
+        }
+
+        // Timestamps bracket each run of commands, with its own pair of queries.
+        for (uint32_t runIndex = 0; runIndex < mRuns.size(); runIndex++) {
+            const Run& run = mRuns[runIndex];
+            auto cpuStart = std::chrono::steady_clock::now();
+            if (timestamps) {
+                dispatch.vkCmdWriteTimestamp(mCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mQueryPool, runIndex * 2);
+            }
+            for (size_t index = run.begin; index < run.end; index++) {
+                dispatch.vkCmdPipelineBarrier(mCommandBuffer,
+                                              VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                              VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                              0,
+                                              1, &barrier,
+                                              0, nullptr,
+                                              0, nullptr);
+                recordCommand(mCommandBuffer, mFrameCommands[index]);
+            }
+            if (timestamps) {
+                dispatch.vkCmdWriteTimestamp(mCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mQueryPool, runIndex * 2 + 1);
+            }
+            cpuTotals[run.pass] += elapsedMilliseconds(cpuStart);
+        }
+        errorCheck(dispatch.vkEndCommandBuffer(mCommandBuffer));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &mCommandBuffer;
+        uint64_t submitSerial;
+        {
+            std::lock_guard<std::mutex> queueLock(mRenderer->getQueueMutex());
+            submitSerial = mRenderer->beginSubmit();
+            errorCheck(dispatch.vkQueueSubmit(mRenderer->getQueue(), 1, &submitInfo, mFence));
+        }
+        errorCheck(dispatch.vkWaitForFences(device, 1, &mFence, VK_TRUE, UINT64_MAX));
+        errorCheck(dispatch.vkResetFences(device, 1, &mFence));
+        // Staging buffers retired by earlier replays are released here when headless.
+        mRenderer->completeSubmit(submitSerial);
+
+        if (timestamps) {
+            double period = mRenderer->getPhysicalDeviceProperties().limits.timestampPeriod;
+            errorCheck(dispatch.vkGetQueryPoolResults(device, mQueryPool, 0, queryCount, queryResults.size() * sizeof(uint64_t), queryResults.data(),
+                                                      sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+            for (uint32_t runIndex = 0; runIndex < mRuns.size(); runIndex++) {
+                uint64_t ticks = queryResults[runIndex * 2 + 1] - queryResults[runIndex * 2];
+                gpuTotals[mRuns[runIndex].pass] += double(ticks) * period / 1000000.0;
+            }
+        }
+    }
+
+    for (size_t pass = 0; pass < mPassTimings.size(); pass++) {
+        mPassTimings[pass].commandCount = commandCounts[pass];
+        mPassTimings[pass].cpuMilliseconds = cpuTotals[pass] / iterations;
+        mPassTimings[pass].gpuMilliseconds = timestamps ? gpuTotals[pass] / iterations : -1.0;
+    }
+    mPassTimings.erase(std::remove_if(mPassTimings.begin(), mPassTimings.end(),
+        [](const TracePassTiming& timing) { return timing.commandCount == 0; }), mPassTimings.end());
+    return true;
+}
+
+const std::vector<TracePassTiming>& TraceReplayer::getPassTimings() const {
+    return mPassTimings;
+}
+
+double TraceReplayer::getSetupMilliseconds() const {
+    return mSetupMilliseconds;
+}
+
+void TraceReplayer::printReport() const {
+    printf("Trace replay (setup %.3f ms):\n", mSetupMilliseconds);
+    for (auto& timing : mPassTimings) {
+        if (timing.gpuMilliseconds >= 0.0) {
+            printf("  %-32s %5u commands | CPU %8.3f ms | GPU %8.3f ms\n",
+                timing.name.c_str(), timing.commandCount, timing.cpuMilliseconds, timing.gpuMilliseconds);
+        } else {
+            printf("  %-32s %5u commands | CPU %8.3f ms | GPU      n/a\n",
+                timing.name.c_str(), timing.commandCount, timing.cpuMilliseconds);
+        }
+    }
+}
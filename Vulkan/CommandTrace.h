@@ -0,0 +1,164 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedBuffer;
+class Renderer;
+
+enum class TraceOp : uint8_t {
+    CreateBuffer = 1,
+    CreateImage,
+    UploadBuffer,
+    CreateComputePipeline,
+    BeginPass,
+    EndPass,
+    ClearImage,
+    CopyBuffer,
+    Dispatch,
+    EndFrame,
+};
+
+// Compact binary stream of engine level rendering commands. Resources are
+// referred to by trace local ids, integers are varint encoded and upload
+// contents can be replaced by their size and a checksum so traces don't carry
+// the application's assets. The same stream can be saved, loaded and replayed
+// on any device, with or without a window.
+class CommandTrace {
+public:
+    static const uint32_t MAGIC = 0x5443564B; // "KVCT"
+    static const uint32_t VERSION = 1;
+
+    // When false, uploads only record their size; the replayer fills them
+    // with a deterministic pattern instead.
+    void setStoreUploadData(bool storeUploadData);
+
+    uint32_t createBuffer(VkDeviceSize size, VkBufferUsageFlags usage);
+    uint32_t createImage(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage);
+    void uploadBuffer(uint32_t buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+    uint32_t createComputePipeline(const std::vector<uint32_t>& spirv, uint32_t bufferCount, uint32_t pushConstantSize);
+
+    void beginPass(const std::string& name);
+    void endPass();
+    void clearImage(uint32_t image, const float color[4]);
+    void copyBuffer(uint32_t source, uint32_t destination, VkDeviceSize sourceOffset, VkDeviceSize destinationOffset, VkDeviceSize size);
+    void dispatch(uint32_t pipeline, const std::vector<uint32_t>& buffers, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                  const void* pushConstants = nullptr, uint32_t pushConstantSize = 0);
+    void endFrame();
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+    void clear();
+
+    const std::vector<uint8_t>& getData() const;
+
+private:
+    void writeOp(TraceOp op);
+    void writeVarint(uint64_t value);
+    void writeFloat(float value);
+    void writeBytes(const void* data, size_t size);
+
+    std::vector<uint8_t> mData;
+    uint32_t mNextBufferId = 0;
+    uint32_t mNextImageId = 0;
+    uint32_t mNextPipelineId = 0;
+    bool mStoreUploadData = true;
+};
+
+struct TracePassTiming {
+    std::string name;
+    uint32_t commandCount = 0;
+    // Averaged over the replayed iterations. GPU time is negative when the
+    // queue doesn't support timestamps.
+    double cpuMilliseconds = 0.0;
+    double gpuMilliseconds = 0.0;
+};
+
+// Replays a CommandTrace on the renderer's device and measures every pass:
+// CPU time to record it and GPU time between timestamps written around it.
+// Only needs a RendererMode::Headless renderer. Commands are separated by
+// full memory barriers so results don't depend on the capturing application's
+// synchronization.
+class TraceReplayer {
+public:
+    TraceReplayer(Renderer* renderer);
+    ~TraceReplayer();
+
+    // Returns false if the trace is malformed. Resources are created once;
+    // the frame's commands are then recorded, submitted and waited on
+    // iterations times.
+    bool replay(const CommandTrace& trace, uint32_t iterations = 1);
+
+    const std::vector<TracePassTiming>& getPassTimings() const;
+    double getSetupMilliseconds() const;
+    void printReport() const;
+
+private:
+    struct Command {
+        TraceOp op;
+        uint32_t pass = 0;
+        std::vector<uint64_t> args;
+        std::vector<uint8_t> bytes;
+        // Staging buffer of an upload or descriptor set of a dispatch.
+        uint32_t resource = 0;
+    };
+
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint32_t memoryTypeIndex = 0;
+        VkDeviceSize size = 0;
+    };
+
+    struct Image {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint32_t memoryTypeIndex = 0;
+        VkDeviceSize size = 0;
+    };
+
+    // Consecutive frame commands of one pass. A pass can have several runs;
+    // pass 0 gets one for every stretch of commands between passes.
+    struct Run {
+        uint32_t pass = 0;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    struct Pipeline {
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        uint32_t bufferCount = 0;
+    };
+
+    bool decode(const CommandTrace& trace);
+    void createResources();
+    void destroyResources();
+    void recordCommand(VkCommandBuffer commandBuffer, const Command& command);
+
+    Renderer* mRenderer = nullptr;
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+    VkFence mFence = VK_NULL_HANDLE;
+    VkQueryPool mQueryPool = VK_NULL_HANDLE;
+    VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
+    bool mTimestampsSupported = false;
+
+    std::vector<Command> mSetupCommands;
+    std::vector<Command> mFrameCommands;
+    std::vector<Run> mRuns;
+    std::vector<Buffer> mBuffers;
+    std::vector<Image> mImages;
+    std::vector<Pipeline> mPipelines;
+    std::vector<std::unique_ptr<MappedBuffer>> mStagingBuffers;
+    std::vector<VkDescriptorSet> mDescriptorSets;
+
+    std::vector<TracePassTiming> mPassTimings;
+    double mSetupMilliseconds = 0.0;
+};
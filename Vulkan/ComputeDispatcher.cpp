@@ -0,0 +1,338 @@
+#include "stdafx.h"
+#include "ComputeDispatcher.h"
+#include "CommandEncoder.h"
+#include "MappedBuffer.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "Shared.h"
+
+#include <assert.h>
+#include <cstdlib>
+#include <fstream>
+
+ComputeBufferBinding::ComputeBufferBinding(const MappedBuffer& buffer)
+    : buffer(buffer.getBuffer()), offset(0), range(VK_WHOLE_SIZE) {}
+
+ComputeDispatcher::ComputeDispatcher(Renderer* renderer, uint32_t maxJobsPerBatch) {
+    mRenderer = renderer;
+    mMaxJobsPerBatch = maxJobsPerBatch > 0 ? maxJobsPerBatch : 1;
+
+    // The renderer's graphics family, which it only picks if it also supports
+    // compute.
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = mRenderer->getGraphicsQueueFamilyIndex();
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    errorCheck(vkCreateCommandPool(mRenderer->getDevice(), &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &mCommandPool));
+
+    mCompletionThread = std::thread(&ComputeDispatcher::completionMain, this);
+}
+
+ComputeDispatcher::~ComputeDispatcher() {
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShouldRun = false;
+    }
+    mCondition.notify_all();
+    mCompletionThread.join();
+
+    VkDevice device = mRenderer->getDevice();
+    for (auto batch : mAllBatches) {
+        vkDestroyFence(device, batch->fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+        vkDestroyDescriptorPool(device, batch->descriptorPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT));
+        delete batch;
+    }
+    vkDestroyCommandPool(device, mCommandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+
+    for (auto& pipeline : mPipelines) {
+        vkDestroyPipeline(device, pipeline.pipeline, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT));
+        vkDestroyPipelineLayout(device, pipeline.pipelineLayout, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_LAYOUT_EXT));
+        vkDestroyDescriptorSetLayout(device, pipeline.descriptorSetLayout, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT));
+        vkDestroyShaderModule(device, pipeline.shaderModule, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT));
+    }
+}
+
+ComputePipelineHandle ComputeDispatcher::loadPipeline(const std::vector<uint32_t>& spirv, uint32_t bufferCount, uint32_t pushConstantSize) {
+    assert(bufferCount <= MAX_BUFFER_BINDINGS && "Too many buffer bindings for a compute pipeline");
+
+    VkDevice device = mRenderer->getDevice();
+    Pipeline pipeline;
+    pipeline.bufferCount = bufferCount;
+    pipeline.pushConstantSize = pushConstantSize;
+
+    VkShaderModuleCreateInfo moduleCreateInfo{};
+    moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleCreateInfo.codeSize = spirv.size() * sizeof(uint32_t);
+    moduleCreateInfo.pCode = spirv.data();
+    errorCheck(vkCreateShaderModule(device, &moduleCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT), &pipeline.shaderModule));
+
+    VkDescriptorSetLayoutBinding bindings[MAX_BUFFER_BINDINGS]{};
+    for (uint32_t i = 0; i < bufferCount; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+    setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutCreateInfo.bindingCount = bufferCount;
+    setLayoutCreateInfo.pBindings = bindings;
+    errorCheck(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT), &pipeline.descriptorSetLayout));
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = pushConstantSize;
+    VkPipelineLayoutCreateInfo layoutCreateInfo{};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.setLayoutCount = 1;
+    layoutCreateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+    layoutCreateInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    errorCheck(vkCreatePipelineLayout(device, &layoutCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_LAYOUT_EXT), &pipeline.pipelineLayout));
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = pipeline.shaderModule;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = pipeline.pipelineLayout;
+    errorCheck(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT), &pipeline.pipeline));
+
+    std::lock_guard<std::mutex> lock(mRecordMutex);
+    mPipelines.push_back(pipeline);
+    return ComputePipelineHandle(mPipelines.size() - 1);
+}
+
+ComputePipelineHandle ComputeDispatcher::loadPipelineFromFile(const std::string& spirvPath, uint32_t bufferCount, uint32_t pushConstantSize) {
+    std::ifstream file(spirvPath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        assert(0 && "Couldn't open compute shader");
+        std::exit(-1);
+    }
+
+    size_t size = size_t(file.tellg());
+    if (size == 0 || size % sizeof(uint32_t) != 0) {
+        assert(0 && "Compute shader isn't valid SPIR-V");
+        std::exit(-1);
+    }
+
+    std::vector<uint32_t> spirv(size / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(spirv.data()), size);
+    return loadPipeline(spirv, bufferCount, pushConstantSize);
+}
+
+std::shared_future<void> ComputeDispatcher::dispatch(const ComputeJob& job) {
+    std::lock_guard<std::mutex> lock(mRecordMutex);
+    assert(job.pipeline < mPipelines.size() && "Unknown compute pipeline");
+    assert(job.buffers.size() == mPipelines[job.pipeline].bufferCount && "Buffer count doesn't match the pipeline");
+    assert(job.pushConstants.size() <= mPipelines[job.pipeline].pushConstantSize && "Push constants larger than the pipeline allows");
+
+    if (mCurrentBatch == nullptr) {
+        mCurrentBatch = acquireBatch();
+    }
+    mCurrentBatch->jobs.push_back(job);
+    mCurrentBatch->promises.emplace_back();
+    std::shared_future<void> future = mCurrentBatch->promises.back().get_future().share();
+
+    if (mCurrentBatch->jobs.size() >= mMaxJobsPerBatch) {
+        submitBatch(mCurrentBatch);
+        mCurrentBatch = nullptr;
+    }
+    return future;
+}
+
+void ComputeDispatcher::flush() {
+    std::lock_guard<std::mutex> lock(mRecordMutex);
+    if (mCurrentBatch != nullptr) {
+        submitBatch(mCurrentBatch);
+        mCurrentBatch = nullptr;
+    }
+}
+
+void ComputeDispatcher::waitIdle() {
+    flush();
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this] { return mInFlight.empty(); });
+}
+
+ComputeDispatcher::Statistics ComputeDispatcher::getStatistics() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStatistics;
+}
+
+ComputeDispatcher::Batch* ComputeDispatcher::acquireBatch() {
+    VkDevice device = mRenderer->getDevice();
+
+    Batch* batch = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFreeBatches.empty()) {
+            batch = mFreeBatches.back();
+            mFreeBatches.pop_back();
+        }
+    }
+
+    if (batch != nullptr) {
+        errorCheck(vkResetFences(device, 1, &batch->fence));
+        errorCheck(vkResetDescriptorPool(device, batch->descriptorPool, 0));
+        return batch;
+    }
+
+    batch = new Batch();
+    mAllBatches.push_back(batch);
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = mCommandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    errorCheck(vkAllocateCommandBuffers(device, &allocateInfo, &batch->commandBuffer));
+
+    // Every job gets one descriptor set with at most MAX_BUFFER_BINDINGS buffers.
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = mMaxJobsPerBatch * MAX_BUFFER_BINDINGS;
+    VkDescriptorPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = mMaxJobsPerBatch;
+    poolCreateInfo.poolSizeCount = 1;
+    poolCreateInfo.pPoolSizes = &poolSize;
+    errorCheck(vkCreateDescriptorPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT), &batch->descriptorPool));
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    errorCheck(vkCreateFence(device, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &batch->fence));
+
+    return batch;
+}
+
+void ComputeDispatcher::recordBatch(Batch* batch) {
+    VkDevice device = mRenderer->getDevice();
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    errorCheck(dispatch.vkBeginCommandBuffer(batch->commandBuffer, &beginInfo));
+
+    VkMemoryBarrier shaderToShader{};
+    shaderToShader.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    shaderToShader.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    shaderToShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    CommandEncoder<ComputePass> encoder(dispatch, batch->commandBuffer);
+    for (auto& job : batch->jobs) {
+        const Pipeline& pipeline = mPipelines[job.pipeline];
+
+        VkDescriptorSetAllocateInfo setAllocateInfo{};
+        setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocateInfo.descriptorPool = batch->descriptorPool;
+        setAllocateInfo.descriptorSetCount = 1;
+        setAllocateInfo.pSetLayouts = &pipeline.descriptorSetLayout;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        errorCheck(dispatch.vkAllocateDescriptorSets(device, &setAllocateInfo, &descriptorSet));
+
+        VkDescriptorBufferInfo bufferInfos[MAX_BUFFER_BINDINGS]{};
+        VkWriteDescriptorSet writes[MAX_BUFFER_BINDINGS]{};
+        for (uint32_t i = 0; i < pipeline.bufferCount; i++) {
+            bufferInfos[i].buffer = job.buffers[i].buffer;
+            bufferInfos[i].offset = job.buffers[i].offset;
+            bufferInfos[i].range = job.buffers[i].range;
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = descriptorSet;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        dispatch.vkUpdateDescriptorSets(device, pipeline.bufferCount, writes, 0, nullptr);
+
+        if (job.dependsOnPrevious) {
+            dispatch.vkCmdPipelineBarrier(batch->commandBuffer,
+                                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                          0,
+                                          1, &shaderToShader,
+                                          0, nullptr,
+                                          0, nullptr);
+        }
+
+        encoder.bindPipeline(pipeline.pipeline);
+        encoder.bindDescriptorSet(pipeline.pipelineLayout, 0, descriptorSet);
+        if (!job.pushConstants.empty()) {
+            encoder.pushConstants(pipeline.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                                  0, uint32_t(job.pushConstants.size()), job.pushConstants.data());
+        }
+        encoder.dispatch(job.groupCountX, job.groupCountY, job.groupCountZ);
+    }
+
+    // Make every result visible to the host once the fence signals.
+    VkMemoryBarrier shaderToHost{};
+    shaderToHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    shaderToHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    shaderToHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    dispatch.vkCmdPipelineBarrier(batch->commandBuffer,
+                                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                  VK_PIPELINE_STAGE_HOST_BIT,
+                                  0,
+                                  1, &shaderToHost,
+                                  0, nullptr,
+                                  0, nullptr);
+
+    errorCheck(dispatch.vkEndCommandBuffer(batch->commandBuffer));
+}
+
+void ComputeDispatcher::submitBatch(Batch* batch) {
+    recordBatch(batch);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->commandBuffer;
+    {
+        std::lock_guard<std::mutex> queueLock(mRenderer->getQueueMutex());
+        batch->submitSerial = mRenderer->beginSubmit();
+        errorCheck(mRenderer->getDispatch().vkQueueSubmit(mRenderer->getQueue(), 1, &submitInfo, batch->fence));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStatistics.jobsSubmitted += batch->jobs.size();
+        mStatistics.batchesSubmitted++;
+        mInFlight.push_back(batch);
+    }
+    mCondition.notify_all();
+}
+
+void ComputeDispatcher::completionMain() {
+    VkDevice device = mRenderer->getDevice();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mCondition.wait(lock, [this] { return !mInFlight.empty() || !mShouldRun; });
+        if (mInFlight.empty()) {
+            return;
+        }
+
+        // Batches complete in submission order on a single queue.
+        Batch* batch = mInFlight.front();
+        lock.unlock();
+        errorCheck(mRenderer->getDispatch().vkWaitForFences(device, 1, &batch->fence, VK_TRUE, UINT64_MAX));
+        // Also collects retired objects when no frames are being rendered.
+        mRenderer->completeSubmit(batch->submitSerial);
+        for (auto& promise : batch->promises) {
+            promise.set_value();
+        }
+        lock.lock();
+
+        mStatistics.jobsCompleted += batch->jobs.size();
+        batch->jobs.clear();
+        batch->promises.clear();
+        mInFlight.pop_front();
+        mFreeBatches.push_back(batch);
+        mCondition.notify_all();
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MappedBuffer;
+class Renderer;
+
+typedef uint32_t ComputePipelineHandle;
+
+struct ComputeBufferBinding {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize range = VK_WHOLE_SIZE;
+
+    ComputeBufferBinding() {}
+    ComputeBufferBinding(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+        : buffer(buffer), offset(offset), range(range) {}
+    ComputeBufferBinding(const MappedBuffer& buffer);
+};
+
+struct ComputeJob {
+    ComputePipelineHandle pipeline = 0;
+    // Bound in order to storage buffer bindings 0..n-1 of set 0.
+    std::vector<ComputeBufferBinding> buffers;
+    uint32_t groupCountX = 1;
+    uint32_t groupCountY = 1;
+    uint32_t groupCountZ = 1;
+    std::vector<uint8_t> pushConstants;
+    // Jobs in a batch run unordered; set this when the job reads what an
+    // earlier job in the same batch wrote.
+    bool dependsOnPrevious = false;
+};
+
+// Compute only work on the renderer's device, no window or swapchain needed.
+// Jobs are collected into batches that are recorded into a single command
+// buffer and submitted once, so small jobs don't each pay for a submit. The
+// returned futures are completed by a background thread when the batch fence
+// signals; results written to host visible buffers are readable by then.
+class ComputeDispatcher {
+public:
+    static const uint32_t MAX_BUFFER_BINDINGS = 8;
+
+    ComputeDispatcher(Renderer* renderer, uint32_t maxJobsPerBatch = 256);
+    ~ComputeDispatcher();
+
+    ComputeDispatcher(const ComputeDispatcher&) = delete;
+    ComputeDispatcher& operator=(const ComputeDispatcher&) = delete;
+
+    // bufferCount storage buffers at bindings 0..bufferCount-1 and up to
+    // pushConstantSize bytes of push constants, entry point "main".
+    ComputePipelineHandle loadPipeline(const std::vector<uint32_t>& spirv, uint32_t bufferCount, uint32_t pushConstantSize = 0);
+    ComputePipelineHandle loadPipelineFromFile(const std::string& spirvPath, uint32_t bufferCount, uint32_t pushConstantSize = 0);
+
+    // Queues the job into the current batch, which is submitted when it's full
+    // or on flush().
+    std::shared_future<void> dispatch(const ComputeJob& job);
+    // Submits the current batch, if any.
+    void flush();
+    // Flushes and blocks until every submitted batch has completed.
+    void waitIdle();
+
+    struct Statistics {
+        uint64_t jobsSubmitted = 0;
+        uint64_t batchesSubmitted = 0;
+        uint64_t jobsCompleted = 0;
+    };
+    Statistics getStatistics() const;
+
+private:
+    struct Pipeline {
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        uint32_t bufferCount = 0;
+        uint32_t pushConstantSize = 0;
+    };
+
+    struct Batch {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t submitSerial = 0;
+        std::vector<ComputeJob> jobs;
+        std::vector<std::promise<void>> promises;
+    };
+
+    Batch* acquireBatch();
+    void submitBatch(Batch* batch);
+    void recordBatch(Batch* batch);
+    void completionMain();
+
+    Renderer* mRenderer = nullptr;
+    uint32_t mMaxJobsPerBatch = 0;
+
+    std::vector<Pipeline> mPipelines;
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+
+    // Guards recording, the pipelines and the current batch.
+    std::mutex mRecordMutex;
+    Batch* mCurrentBatch = nullptr;
+    std::vector<Batch*> mAllBatches;
+
+    // Shared with the completion thread.
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<Batch*> mInFlight;
+    std::vector<Batch*> mFreeBatches;
+    Statistics mStatistics;
+    bool mShouldRun = true;
+    std::thread mCompletionThread;
+};
@@ -0,0 +1,484 @@
+#include "stdafx.h"
+#include "Culling.h"
+#include "ThreadPool.h"
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CULLING_HAS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CULLING_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define CULLING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM) || defined(_M_ARM64)
+#define CULLING_HAS_NEON 1
+#include <arm_neon.h>
+#endif
+
+const char* cullingIsaName(CullingIsa isa) {
+    switch (isa) {
+    case CullingIsa::Scalar:
+        return "Scalar";
+    case CullingIsa::SSE:
+        return "SSE";
+    case CullingIsa::AVX2:
+        return "AVX2";
+    case CullingIsa::NEON:
+        return "NEON";
+    default:
+        return "Unknown";
+    }
+}
+
+CullingIsa detectBestCullingIsa() {
+#if CULLING_HAS_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    // The OS has to save the YMM registers across context switches as well.
+    bool ymmEnabled = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+    if (avx && avx2 && ymmEnabled) {
+        return CullingIsa::AVX2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return CullingIsa::AVX2;
+    }
+#endif
+    return CullingIsa::SSE;
+#elif CULLING_HAS_NEON
+    return CullingIsa::NEON;
+#else
+    return CullingIsa::Scalar;
+#endif
+}
+
+uint32_t BoundsStore::add(const float center[3], const float extent[3]) {
+    uint32_t index = uint32_t(mCenterX.size());
+    mCenterX.push_back(center[0]);
+    mCenterY.push_back(center[1]);
+    mCenterZ.push_back(center[2]);
+    mExtentX.push_back(extent[0]);
+    mExtentY.push_back(extent[1]);
+    mExtentZ.push_back(extent[2]);
+    return index;
+}
+
+void BoundsStore::set(uint32_t index, const float center[3], const float extent[3]) {
+    assert(index < mCenterX.size());
+    mCenterX[index] = center[0];
+    mCenterY[index] = center[1];
+    mCenterZ[index] = center[2];
+    mExtentX[index] = extent[0];
+    mExtentY[index] = extent[1];
+    mExtentZ[index] = extent[2];
+}
+
+void BoundsStore::clear() {
+    mCenterX.clear();
+    mCenterY.clear();
+    mCenterZ.clear();
+    mExtentX.clear();
+    mExtentY.clear();
+    mExtentZ.clear();
+}
+
+void BoundsStore::reserve(size_t count) {
+    mCenterX.reserve(count);
+    mCenterY.reserve(count);
+    mCenterZ.reserve(count);
+    mExtentX.reserve(count);
+    mExtentY.reserve(count);
+    mExtentZ.reserve(count);
+}
+
+size_t BoundsStore::size() const {
+    return mCenterX.size();
+}
+
+const float* BoundsStore::getCenterX() const {
+    return mCenterX.data();
+}
+
+const float* BoundsStore::getCenterY() const {
+    return mCenterY.data();
+}
+
+const float* BoundsStore::getCenterZ() const {
+    return mCenterZ.data();
+}
+
+const float* BoundsStore::getExtentX() const {
+    return mExtentX.data();
+}
+
+const float* BoundsStore::getExtentY() const {
+    return mExtentY.data();
+}
+
+const float* BoundsStore::getExtentZ() const {
+    return mExtentZ.data();
+}
+
+namespace {
+
+struct CullInput {
+    const float* cx;
+    const float* cy;
+    const float* cz;
+    const float* ex;
+    const float* ey;
+    const float* ez;
+    const FrustumPlanes* planes;
+    uint8_t* visibility;
+};
+
+CullInput makeInput(const BoundsStore& bounds, const FrustumPlanes& planes, uint8_t* visibility) {
+    CullInput input;
+    input.cx = bounds.getCenterX();
+    input.cy = bounds.getCenterY();
+    input.cz = bounds.getCenterZ();
+    input.ex = bounds.getExtentX();
+    input.ey = bounds.getExtentY();
+    input.ez = bounds.getExtentZ();
+    input.planes = &planes;
+    input.visibility = visibility;
+    return input;
+}
+
+// An AABB is outside when it lies entirely behind one plane:
+// dot(n, center) + d + dot(abs(n), extent) < 0.
+uint32_t cullKernelScalar(const CullInput& in, size_t begin, size_t end) {
+    const FrustumPlanes& p = *in.planes;
+    uint32_t visibleCount = 0;
+    for (size_t i = begin; i < end; i++) {
+        bool visible = true;
+        for (int plane = 0; plane < 6 && visible; plane++) {
+            float dist = p.nx[plane] * in.cx[i] + p.ny[plane] * in.cy[i] + p.nz[plane] * in.cz[i] + p.d[plane];
+            float radius = std::fabs(p.nx[plane]) * in.ex[i] + std::fabs(p.ny[plane]) * in.ey[i] + std::fabs(p.nz[plane]) * in.ez[i];
+            visible = dist + radius >= 0.0f;
+        }
+        in.visibility[i] = visible ? 1 : 0;
+        visibleCount += visible ? 1 : 0;
+    }
+    return visibleCount;
+}
+
+#if CULLING_HAS_X86
+
+uint32_t cullKernelSse(const CullInput& in, size_t begin, size_t end) {
+    const FrustumPlanes& p = *in.planes;
+    __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (int plane = 0; plane < 6; plane++) {
+        nx[plane] = _mm_set1_ps(p.nx[plane]);
+        ny[plane] = _mm_set1_ps(p.ny[plane]);
+        nz[plane] = _mm_set1_ps(p.nz[plane]);
+        ax[plane] = _mm_set1_ps(std::fabs(p.nx[plane]));
+        ay[plane] = _mm_set1_ps(std::fabs(p.ny[plane]));
+        az[plane] = _mm_set1_ps(std::fabs(p.nz[plane]));
+        d[plane] = _mm_set1_ps(p.d[plane]);
+    }
+    const __m128 zero = _mm_setzero_ps();
+
+    uint32_t visibleCount = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(in.cx + i);
+        __m128 cy = _mm_loadu_ps(in.cy + i);
+        __m128 cz = _mm_loadu_ps(in.cz + i);
+        __m128 ex = _mm_loadu_ps(in.ex + i);
+        __m128 ey = _mm_loadu_ps(in.ey + i);
+        __m128 ez = _mm_loadu_ps(in.ez + i);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int plane = 0; plane < 6; plane++) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[plane], cx), _mm_mul_ps(ny[plane], cy)),
+                                     _mm_add_ps(_mm_mul_ps(nz[plane], cz), d[plane]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[plane], ex), _mm_mul_ps(ay[plane], ey)),
+                                       _mm_mul_ps(az[plane], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++) {
+            uint8_t visible = uint8_t((mask >> lane) & 1);
+            in.visibility[i + lane] = visible;
+            visibleCount += visible;
+        }
+    }
+
+    return visibleCount + cullKernelScalar(in, i, end);
+}
+
+CULLING_TARGET_AVX2 uint32_t cullKernelAvx2(const CullInput& in, size_t begin, size_t end) {
+    const FrustumPlanes& p = *in.planes;
+    __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (int plane = 0; plane < 6; plane++) {
+        nx[plane] = _mm256_set1_ps(p.nx[plane]);
+        ny[plane] = _mm256_set1_ps(p.ny[plane]);
+        nz[plane] = _mm256_set1_ps(p.nz[plane]);
+        ax[plane] = _mm256_set1_ps(std::fabs(p.nx[plane]));
+        ay[plane] = _mm256_set1_ps(std::fabs(p.ny[plane]));
+        az[plane] = _mm256_set1_ps(std::fabs(p.nz[plane]));
+        d[plane] = _mm256_set1_ps(p.d[plane]);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+
+    uint32_t visibleCount = 0;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(in.cx + i);
+        __m256 cy = _mm256_loadu_ps(in.cy + i);
+        __m256 cz = _mm256_loadu_ps(in.cz + i);
+        __m256 ex = _mm256_loadu_ps(in.ex + i);
+        __m256 ey = _mm256_loadu_ps(in.ey + i);
+        __m256 ez = _mm256_loadu_ps(in.ez + i);
+
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int plane = 0; plane < 6; plane++) {
+            __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[plane], cx), _mm256_mul_ps(ny[plane], cy)),
+                                        _mm256_add_ps(_mm256_mul_ps(nz[plane], cz), d[plane]));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[plane], ex), _mm256_mul_ps(ay[plane], ey)),
+                                          _mm256_mul_ps(az[plane], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, radius), zero, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; lane++) {
+            uint8_t visible = uint8_t((mask >> lane) & 1);
+            in.visibility[i + lane] = visible;
+            visibleCount += visible;
+        }
+    }
+
+    // Finish the remainder with the 4-wide kernel, then scalar.
+    return visibleCount + cullKernelSse(in, i, end);
+}
+
+#endif // CULLING_HAS_X86
+
+#if CULLING_HAS_NEON
+
+uint32_t cullKernelNeon(const CullInput& in, size_t begin, size_t end) {
+    const FrustumPlanes& p = *in.planes;
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    uint32_t visibleCount = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        float32x4_t cx = vld1q_f32(in.cx + i);
+        float32x4_t cy = vld1q_f32(in.cy + i);
+        float32x4_t cz = vld1q_f32(in.cz + i);
+        float32x4_t ex = vld1q_f32(in.ex + i);
+        float32x4_t ey = vld1q_f32(in.ey + i);
+        float32x4_t ez = vld1q_f32(in.ez + i);
+
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+        for (int plane = 0; plane < 6; plane++) {
+            float32x4_t dist = vmlaq_n_f32(vdupq_n_f32(p.d[plane]), cx, p.nx[plane]);
+            dist = vmlaq_n_f32(dist, cy, p.ny[plane]);
+            dist = vmlaq_n_f32(dist, cz, p.nz[plane]);
+            dist = vmlaq_n_f32(dist, ex, std::fabs(p.nx[plane]));
+            dist = vmlaq_n_f32(dist, ey, std::fabs(p.ny[plane]));
+            dist = vmlaq_n_f32(dist, ez, std::fabs(p.nz[plane]));
+            inside = vandq_u32(inside, vcgeq_f32(dist, zero));
+        }
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, inside);
+        for (int lane = 0; lane < 4; lane++) {
+            uint8_t visible = lanes[lane] ? 1 : 0;
+            in.visibility[i + lane] = visible;
+            visibleCount += visible;
+        }
+    }
+
+    return visibleCount + cullKernelScalar(in, i, end);
+}
+
+#endif // CULLING_HAS_NEON
+
+} // namespace
+
+FrustumCuller::FrustumCuller() {
+    mIsa = detectBestCullingIsa();
+}
+
+void FrustumCuller::setViewProjection(const float m[16]) {
+    // Gribb/Hartmann plane extraction; row r of the matrix is (m[r], m[4 + r], m[8 + r], m[12 + r]).
+    float planes[6][4];
+    for (int c = 0; c < 4; c++) {
+        float row0 = m[c * 4 + 0];
+        float row1 = m[c * 4 + 1];
+        float row2 = m[c * 4 + 2];
+        float row3 = m[c * 4 + 3];
+        planes[0][c] = row3 + row0; // left
+        planes[1][c] = row3 - row0; // right
+        planes[2][c] = row3 + row1; // bottom
+        planes[3][c] = row3 - row1; // top
+        planes[4][c] = row2;        // near, depth range is [0, 1]
+        planes[5][c] = row3 - row2; // far
+    }
+
+    FrustumPlanes result;
+    for (int plane = 0; plane < 6; plane++) {
+        float length = std::sqrt(planes[plane][0] * planes[plane][0] +
+                                 planes[plane][1] * planes[plane][1] +
+                                 planes[plane][2] * planes[plane][2]);
+        float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+        result.nx[plane] = planes[plane][0] * invLength;
+        result.ny[plane] = planes[plane][1] * invLength;
+        result.nz[plane] = planes[plane][2] * invLength;
+        result.d[plane] = planes[plane][3] * invLength;
+    }
+    mPlanes = result;
+}
+
+void FrustumCuller::setPlanes(const FrustumPlanes& planes) {
+    mPlanes = planes;
+}
+
+const FrustumPlanes& FrustumCuller::getPlanes() const {
+    return mPlanes;
+}
+
+void FrustumCuller::setIsa(CullingIsa isa) {
+    mIsa = isa;
+}
+
+CullingIsa FrustumCuller::getIsa() const {
+    return mIsa;
+}
+
+void FrustumCuller::setParallelThreshold(size_t objectCount) {
+    mParallelThreshold = objectCount;
+}
+
+uint32_t FrustumCuller::cull(const BoundsStore& bounds, uint8_t* visibility, ThreadPool* pool) const {
+    size_t count = bounds.size();
+    if (pool == nullptr || count < mParallelThreshold) {
+        return cullRange(bounds, visibility, 0, count);
+    }
+
+    // Keep batches big enough that dispatch cost stays small next to the kernel.
+    std::atomic<uint32_t> visibleCount{ 0 };
+    size_t minBatch = (mParallelThreshold / 4 + 7) & ~size_t(7);
+    pool->parallelFor(count, minBatch, [&](size_t begin, size_t end) {
+        visibleCount += cullRange(bounds, visibility, begin, end);
+    });
+    return visibleCount;
+}
+
+uint32_t FrustumCuller::cullScalar(const BoundsStore& bounds, uint8_t* visibility) const {
+    return cullKernelScalar(makeInput(bounds, mPlanes, visibility), 0, bounds.size());
+}
+
+uint32_t FrustumCuller::cullRange(const BoundsStore& bounds, uint8_t* visibility, size_t begin, size_t end) const {
+    CullInput input = makeInput(bounds, mPlanes, visibility);
+
+    switch (mIsa) {
+#if CULLING_HAS_X86
+    case CullingIsa::AVX2:
+        return cullKernelAvx2(input, begin, end);
+    case CullingIsa::SSE:
+        return cullKernelSse(input, begin, end);
+#endif
+#if CULLING_HAS_NEON
+    case CullingIsa::NEON:
+        return cullKernelNeon(input, begin, end);
+#endif
+    default:
+        return cullKernelScalar(input, begin, end);
+    }
+}
+
+void benchmarkCulling(size_t objectCount, uint32_t iterations, ThreadPool* pool) {
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    BoundsStore bounds;
+    bounds.reserve(objectCount);
+    for (size_t i = 0; i < objectCount; i++) {
+        float center[3] = { position(random), position(random), position(random) };
+        float extent[3] = { size(random), size(random), size(random) };
+        bounds.add(center, extent);
+    }
+
+    // 90 degree perspective looking down -z, near 0.1 and far 300.
+    const float nearZ = 0.1f;
+    const float farZ = 300.0f;
+    float viewProjection[16] = {};
+    viewProjection[0] = 1.0f;
+    viewProjection[5] = 1.0f;
+    viewProjection[10] = farZ / (nearZ - farZ);
+    viewProjection[11] = -1.0f;
+    viewProjection[14] = nearZ * farZ / (nearZ - farZ);
+
+    FrustumCuller culler;
+    culler.setViewProjection(viewProjection);
+    CullingIsa bestIsa = culler.getIsa();
+
+    std::vector<uint8_t> reference(objectCount);
+    std::vector<uint8_t> visibility(objectCount);
+    uint32_t referenceCount = culler.cullScalar(bounds, reference.data());
+    iterations = iterations ? iterations : 1;
+
+    std::vector<CullingIsa> isas;
+    isas.push_back(CullingIsa::Scalar);
+#if CULLING_HAS_X86
+    isas.push_back(CullingIsa::SSE);
+    if (bestIsa == CullingIsa::AVX2) {
+        isas.push_back(CullingIsa::AVX2);
+    }
+#elif CULLING_HAS_NEON
+    isas.push_back(CullingIsa::NEON);
+#endif
+
+    printf("Culling %lld objects, %lld visible, %u iterations\n", (long long)objectCount, (long long)referenceCount, iterations);
+    double scalarMilliseconds = 0.0;
+    for (size_t run = 0; run <= isas.size(); run++) {
+        // The last run is the best kernel split across the pool.
+        bool threaded = run == isas.size();
+        if (threaded && pool == nullptr) {
+            break;
+        }
+        culler.setIsa(threaded ? bestIsa : isas[run]);
+        culler.setParallelThreshold(threaded ? 16384 : SIZE_MAX);
+
+        uint32_t visibleCount = culler.cull(bounds, visibility.data(), pool);
+        bool matches = visibleCount == referenceCount && visibility == reference;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++) {
+            culler.cull(bounds, visibility.data(), pool);
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+        if (run == 0) {
+            scalarMilliseconds = milliseconds;
+        }
+
+        printf("  %-6s%s %8.3f ms  %6.2f ns/object  %5.2fx%s\n", cullingIsaName(culler.getIsa()), threaded ? " MT" : "   ",
+               milliseconds, milliseconds * 1e6 / double(objectCount ? objectCount : 1),
+               milliseconds > 0.0 ? scalarMilliseconds / milliseconds : 0.0, matches ? "" : "  MISMATCH");
+    }
+}
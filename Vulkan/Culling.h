@@ -0,0 +1,89 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+enum class CullingIsa {
+    Scalar,
+    SSE,
+    AVX2,
+    NEON,
+};
+
+const char* cullingIsaName(CullingIsa isa);
+CullingIsa detectBestCullingIsa();
+
+// Axis aligned bounding boxes stored as structure-of-arrays so the culling
+// kernels can load 4 or 8 objects per register.
+class BoundsStore {
+public:
+    uint32_t add(const float center[3], const float extent[3]);
+    void set(uint32_t index, const float center[3], const float extent[3]);
+    void clear();
+    void reserve(size_t count);
+
+    size_t size() const;
+
+    const float* getCenterX() const;
+    const float* getCenterY() const;
+    const float* getCenterZ() const;
+    const float* getExtentX() const;
+    const float* getExtentY() const;
+    const float* getExtentZ() const;
+
+private:
+    AlignedVector<float> mCenterX;
+    AlignedVector<float> mCenterY;
+    AlignedVector<float> mCenterZ;
+    AlignedVector<float> mExtentX;
+    AlignedVector<float> mExtentY;
+    AlignedVector<float> mExtentZ;
+};
+
+// Six planes in the form n.p + d >= 0 for points inside the frustum,
+// stored per component like the bounds.
+struct FrustumPlanes {
+    float nx[6];
+    float ny[6];
+    float nz[6];
+    float d[6];
+};
+
+class FrustumCuller {
+public:
+    FrustumCuller();
+
+    // Column-major view-projection matrix with a [0, 1] depth range (Vulkan clip space).
+    void setViewProjection(const float viewProjection[16]);
+    void setPlanes(const FrustumPlanes& planes);
+    const FrustumPlanes& getPlanes() const;
+
+    void setIsa(CullingIsa isa);
+    CullingIsa getIsa() const;
+
+    // Writes 1 for visible and 0 for culled objects into visibility, which must
+    // hold bounds.size() entries. Returns the number of visible objects.
+    // Scenes larger than the parallel threshold are split across the pool.
+    uint32_t cull(const BoundsStore& bounds, uint8_t* visibility, ThreadPool* pool = nullptr) const;
+
+    // Same test, always on the scalar path; used as the reference implementation.
+    uint32_t cullScalar(const BoundsStore& bounds, uint8_t* visibility) const;
+
+    void setParallelThreshold(size_t objectCount);
+
+private:
+    uint32_t cullRange(const BoundsStore& bounds, uint8_t* visibility, size_t begin, size_t end) const;
+
+    FrustumPlanes mPlanes = {};
+    CullingIsa mIsa = CullingIsa::Scalar;
+    size_t mParallelThreshold = 16384;
+};
+
+// Culls objectCount random boxes with every code path this CPU supports, then
+// with the best one split across the pool, and prints the time per pass. SIMD
+// results are checked against the scalar reference.
+void benchmarkCulling(size_t objectCount, uint32_t iterations, ThreadPool* pool = nullptr);
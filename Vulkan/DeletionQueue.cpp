@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "DeletionQueue.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "MemoryBudget.h"
+
+#include <vector>
+
+DeletionQueue::DeletionQueue(Renderer* renderer) {
+    mRenderer = renderer;
+}
+
+DeletionQueue::~DeletionQueue() {
+    flush();
+}
+
+void DeletionQueue::retire(std::function<void()> destroy) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // Serials only grow, so the queue stays sorted.
+    mEntries.push_back({ mRenderer->getSubmitSerial(), std::move(destroy) });
+}
+
+void DeletionQueue::retireBuffer(VkBuffer buffer) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, buffer] {
+        vkDestroyBuffer(device, buffer, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT));
+    });
+}
+
+void DeletionQueue::retireImage(VkImage image) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, image] {
+        vkDestroyImage(device, image, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT));
+    });
+}
+
+void DeletionQueue::retireImageView(VkImageView imageView) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, imageView] {
+        vkDestroyImageView(device, imageView, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_VIEW_EXT));
+    });
+}
+
+void DeletionQueue::retireMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size) {
+    Renderer* renderer = mRenderer;
+    // Counted as pending right away so eviction doesn't ask for it again.
+    renderer->getMemoryBudget().retire(memoryTypeIndex, size);
+    retire([renderer, memory, memoryTypeIndex, size] {
+        renderer->getMemoryBudget().freeRetired(memory, memoryTypeIndex, size);
+    });
+}
+
+void DeletionQueue::retireSwapchain(VkSwapchainKHR swapchain) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, swapchain] {
+        vkDestroySwapchainKHR(device, swapchain, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SWAPCHAIN_KHR_EXT));
+    });
+}
+
+void DeletionQueue::retireSemaphore(VkSemaphore semaphore) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, semaphore] {
+        vkDestroySemaphore(device, semaphore, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT));
+    });
+}
+
+void DeletionQueue::retireFence(VkFence fence) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, fence] {
+        vkDestroyFence(device, fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+    });
+}
+
+void DeletionQueue::retirePipeline(VkPipeline pipeline) {
+    VkDevice device = mRenderer->getDevice();
+    retire([device, pipeline] {
+        vkDestroyPipeline(device, pipeline, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT));
+    });
+}
+
+void DeletionQueue::collect(uint64_t completedSubmitSerial) {
+    // Collects are serialized so objects retired together, such as command
+    // buffers and then their pool, are destroyed in order. The destroy calls
+    // run outside mMutex; they may retire more objects.
+    std::lock_guard<std::mutex> collectLock(mCollectMutex);
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        while (!mEntries.empty() && mEntries.front().submitSerial <= completedSubmitSerial) {
+            ready.push_back(std::move(mEntries.front().destroy));
+            mEntries.pop_front();
+        }
+    }
+    for (auto& destroy : ready) {
+        destroy();
+    }
+}
+
+void DeletionQueue::flush() {
+    while (getPendingCount() > 0) {
+        collect(UINT64_MAX);
+    }
+}
+
+size_t DeletionQueue::getPendingCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mEntries.size();
+}
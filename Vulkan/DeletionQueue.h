@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class Renderer;
+
+// Defers destroying Vulkan objects until the GPU is done with them. Objects
+// are tagged with the renderer's submit serial when retired and destroyed
+// once that serial completes, which covers every submit made before the
+// retire call since the queue completes work in order. Frames, compute
+// batches and trace replays all complete serials, so this also runs without
+// any window. Resources can then be replaced mid-session without waiting for
+// the whole device to go idle.
+class DeletionQueue {
+public:
+    DeletionQueue(Renderer* renderer);
+    ~DeletionQueue();
+
+    // Safe from any thread. Retire an object after the last submit that uses it.
+    void retire(std::function<void()> destroy);
+    void retireBuffer(VkBuffer buffer);
+    void retireImage(VkImage image);
+    void retireImageView(VkImageView imageView);
+    void retireMemory(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size);
+    void retireSwapchain(VkSwapchainKHR swapchain);
+    void retireSemaphore(VkSemaphore semaphore);
+    void retireFence(VkFence fence);
+    void retirePipeline(VkPipeline pipeline);
+
+    // Destroys everything retired up to completedSubmitSerial. Called through
+    // Renderer::completeSubmit() by whichever thread waited on the submit, so
+    // destroy calls can run on any of them, but one collect at a time and in
+    // retire order.
+    void collect(uint64_t completedSubmitSerial);
+    // Destroys everything; the caller guarantees the GPU is idle.
+    void flush();
+
+    size_t getPendingCount() const;
+
+private:
+    struct Entry {
+        uint64_t submitSerial;
+        std::function<void()> destroy;
+    };
+
+    Renderer* mRenderer = nullptr;
+
+    std::mutex mCollectMutex;
+    mutable std::mutex mMutex;
+    std::deque<Entry> mEntries;
+};
@@ -0,0 +1,202 @@
+#include "stdafx.h"
+#include "DrawQueue.h"
+#include "CommandEncoder.h"
+
+#include <assert.h>
+#include <algorithm>
+
+DrawKey makeDrawKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth) {
+    using namespace DrawKeyLayout;
+    assert(pass < (1u << PASS_BITS));
+    assert(pipeline < (1u << PIPELINE_BITS));
+    assert(material < (1u << MATERIAL_BITS));
+    assert(mesh < (1u << MESH_BITS));
+
+    return (DrawKey(pass) << PASS_SHIFT) |
+           (DrawKey(pipeline) << PIPELINE_SHIFT) |
+           (DrawKey(material) << MATERIAL_SHIFT) |
+           (DrawKey(mesh) << MESH_SHIFT) |
+           (DrawKey(depth) << DEPTH_SHIFT);
+}
+
+uint32_t drawKeyPass(DrawKey key) {
+    using namespace DrawKeyLayout;
+    return uint32_t(key >> PASS_SHIFT) & ((1u << PASS_BITS) - 1);
+}
+
+uint32_t drawKeyPipeline(DrawKey key) {
+    using namespace DrawKeyLayout;
+    return uint32_t(key >> PIPELINE_SHIFT) & ((1u << PIPELINE_BITS) - 1);
+}
+
+uint32_t drawKeyMaterial(DrawKey key) {
+    using namespace DrawKeyLayout;
+    return uint32_t(key >> MATERIAL_SHIFT) & ((1u << MATERIAL_BITS) - 1);
+}
+
+uint32_t drawKeyMesh(DrawKey key) {
+    using namespace DrawKeyLayout;
+    return uint32_t(key >> MESH_SHIFT) & ((1u << MESH_BITS) - 1);
+}
+
+uint16_t quantizeDrawDepth(float viewDepth, float nearZ, float farZ) {
+    float normalized = (viewDepth - nearZ) / (farZ - nearZ);
+    normalized = std::min(std::max(normalized, 0.0f), 1.0f);
+    return uint16_t(normalized * 65535.0f);
+}
+
+uint32_t DrawQueue::addPipeline(const DrawPipeline& pipeline) {
+    assert(mPipelines.size() < (1u << DrawKeyLayout::PIPELINE_BITS));
+    mPipelines.push_back(pipeline);
+    return uint32_t(mPipelines.size() - 1);
+}
+
+uint32_t DrawQueue::addMaterial(const DrawMaterial& material) {
+    assert(mMaterials.size() < (1u << DrawKeyLayout::MATERIAL_BITS));
+    mMaterials.push_back(material);
+    return uint32_t(mMaterials.size() - 1);
+}
+
+uint32_t DrawQueue::addMesh(const DrawMesh& mesh) {
+    assert(mMeshes.size() < (1u << DrawKeyLayout::MESH_BITS));
+    mMeshes.push_back(mesh);
+    return uint32_t(mMeshes.size() - 1);
+}
+
+void DrawQueue::setBindlessDescriptorSet(VkDescriptorSet descriptorSet) {
+    assert(mKeys.empty());
+    mBindlessDescriptorSet = descriptorSet;
+}
+
+void DrawQueue::submit(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth, uint32_t instanceData) {
+    assert(pipeline < mPipelines.size());
+    assert(material < mMaterials.size());
+    assert(mesh < mMeshes.size());
+    if (mBindlessDescriptorSet != VK_NULL_HANDLE) {
+        // The material travels with the instance, so it's left out of the key.
+        mKeys.push_back(makeDrawKey(pass, pipeline, 0, mesh, depth));
+        mPayloads.push_back(uint32_t(mBindlessDraws.size()));
+        mBindlessDraws.push_back({ instanceData, mMaterials[material].bindlessIndex });
+        return;
+    }
+    mKeys.push_back(makeDrawKey(pass, pipeline, material, mesh, depth));
+    mPayloads.push_back(instanceData);
+}
+
+void DrawQueue::clear() {
+    mKeys.clear();
+    mPayloads.clear();
+    mBindlessDraws.clear();
+    mBatches.clear();
+    mInstanceData.clear();
+    mStatistics = DrawStatistics();
+}
+
+void DrawQueue::sort() {
+    mStatistics.drawsSubmitted = uint32_t(mKeys.size());
+    radixSort();
+
+    mBatches.clear();
+    mInstanceData.clear();
+    mInstanceData.reserve(mBindlessDescriptorSet != VK_NULL_HANDLE ? mKeys.size() * 2 : mKeys.size());
+
+    // Draws sharing every state field are merged; depth only orders them.
+    for (size_t i = 0; i < mKeys.size(); i++) {
+        DrawKey state = mKeys[i] & DrawKeyLayout::STATE_MASK;
+        if (!mBatches.empty() && mBatches.back().key == state) {
+            mBatches.back().instanceCount++;
+            mStatistics.drawsMerged++;
+        } else {
+            Batch batch;
+            batch.key = state;
+            batch.firstInstance = uint32_t(i);
+            batch.instanceCount = 1;
+            mBatches.push_back(batch);
+        }
+        if (mBindlessDescriptorSet != VK_NULL_HANDLE) {
+            const BindlessDraw& draw = mBindlessDraws[mPayloads[i]];
+            mInstanceData.push_back(draw.instanceData);
+            mInstanceData.push_back(draw.materialIndex);
+        } else {
+            mInstanceData.push_back(mPayloads[i]);
+        }
+    }
+}
+
+void DrawQueue::record(const VulkanDispatch& dispatch, VkCommandBuffer commandBuffer, uint32_t pass) {
+    // Always counted; the draw statistics report the skipped binds in every build.
+    CommandEncoder<GraphicsPass, true> encoder(dispatch, commandBuffer);
+
+    for (const Batch& batch : mBatches) {
+        if (drawKeyPass(batch.key) != pass) {
+            continue;
+        }
+
+        const DrawPipeline& pipeline = mPipelines[drawKeyPipeline(batch.key)];
+        const DrawMaterial& material = mMaterials[drawKeyMaterial(batch.key)];
+        const DrawMesh& mesh = mMeshes[drawKeyMesh(batch.key)];
+
+        encoder.bindPipeline(pipeline.pipeline);
+        if (mBindlessDescriptorSet != VK_NULL_HANDLE) {
+            encoder.bindDescriptorSet(pipeline.layout, 0, mBindlessDescriptorSet);
+        } else if (material.descriptorSet != VK_NULL_HANDLE) {
+            encoder.bindDescriptorSet(pipeline.layout, 0, material.descriptorSet);
+        }
+        encoder.bindVertexBuffer(0, mesh.vertexBuffer, mesh.vertexOffset);
+
+        if (mesh.indexBuffer != VK_NULL_HANDLE) {
+            encoder.bindIndexBuffer(mesh.indexBuffer, mesh.indexOffset, mesh.indexType);
+            encoder.drawIndexed(mesh.indexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+        } else {
+            encoder.draw(mesh.vertexCount, batch.instanceCount, 0, batch.firstInstance);
+        }
+        mStatistics.drawsRecorded++;
+    }
+
+    const CommandEncoderStatistics& encoderStatistics = encoder.getStatistics();
+    mStatistics.pipelineBindsSkipped += encoderStatistics.pipelineBindsSkipped;
+    mStatistics.descriptorBindsSkipped += encoderStatistics.descriptorBindsSkipped;
+    mStatistics.vertexBufferBindsSkipped += encoderStatistics.vertexBufferBindsSkipped;
+    mStatistics.indexBufferBindsSkipped += encoderStatistics.indexBufferBindsSkipped;
+}
+
+const std::vector<uint32_t>& DrawQueue::getInstanceData() const {
+    return mInstanceData;
+}
+
+const DrawStatistics& DrawQueue::getStatistics() const {
+    return mStatistics;
+}
+
+void DrawQueue::radixSort() {
+    size_t count = mKeys.size();
+    mSortKeys.resize(count);
+    mSortPayloads.resize(count);
+
+    // LSD radix sort, 8 bits per pass. Passes where every key has the same
+    // digit (typically the pass and pipeline bytes) are skipped.
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+        for (size_t i = 0; i < count; i++) {
+            histogram[(mKeys[i] >> shift) & 0xFF]++;
+        }
+        if (count == 0 || histogram[(mKeys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < 256; digit++) {
+            uint32_t digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t destination = histogram[(mKeys[i] >> shift) & 0xFF]++;
+            mSortKeys[destination] = mKeys[i];
+            mSortPayloads[destination] = mPayloads[i];
+        }
+        mKeys.swap(mSortKeys);
+        mPayloads.swap(mSortPayloads);
+    }
+}
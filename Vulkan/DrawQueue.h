@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+#include <vector>
+
+struct VulkanDispatch;
+
+// Draw sort key, most significant bits first:
+//   pass (4) | pipeline (12) | material (16) | mesh (16) | depth (16)
+// Sorting the keys groups draws by state, so consecutive draws that only
+// differ in depth can be merged into one instanced draw.
+typedef uint64_t DrawKey;
+
+namespace DrawKeyLayout {
+    static const uint32_t DEPTH_BITS = 16;
+    static const uint32_t MESH_BITS = 16;
+    static const uint32_t MATERIAL_BITS = 16;
+    static const uint32_t PIPELINE_BITS = 12;
+    static const uint32_t PASS_BITS = 4;
+
+    static const uint32_t DEPTH_SHIFT = 0;
+    static const uint32_t MESH_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+    static const uint32_t MATERIAL_SHIFT = MESH_SHIFT + MESH_BITS;
+    static const uint32_t PIPELINE_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+    static const uint32_t PASS_SHIFT = PIPELINE_SHIFT + PIPELINE_BITS;
+
+    static const DrawKey STATE_MASK = ~((DrawKey(1) << MESH_SHIFT) - 1);
+}
+
+DrawKey makeDrawKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth);
+uint32_t drawKeyPass(DrawKey key);
+uint32_t drawKeyPipeline(DrawKey key);
+uint32_t drawKeyMaterial(DrawKey key);
+uint32_t drawKeyMesh(DrawKey key);
+
+// Quantizes a view depth in [nearZ, farZ] to the 16-bit key field.
+uint16_t quantizeDrawDepth(float viewDepth, float nearZ, float farZ);
+
+struct DrawPipeline {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+};
+
+struct DrawMaterial {
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    // Index shaders use to find the material's data in bindless mode.
+    uint32_t bindlessIndex = 0;
+};
+
+struct DrawMesh {
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize vertexOffset = 0;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkDeviceSize indexOffset = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+    uint32_t indexCount = 0;
+    uint32_t vertexCount = 0;
+};
+
+struct DrawStatistics {
+    uint32_t drawsSubmitted = 0;
+    uint32_t drawsRecorded = 0;
+    uint32_t drawsMerged = 0;
+    uint32_t pipelineBindsSkipped = 0;
+    uint32_t descriptorBindsSkipped = 0;
+    uint32_t vertexBufferBindsSkipped = 0;
+    uint32_t indexBufferBindsSkipped = 0;
+};
+
+// Collects the draws of a frame, radix sorts them by key and records them
+// with instancing and without redundant binds.
+class DrawQueue {
+public:
+    uint32_t addPipeline(const DrawPipeline& pipeline);
+    uint32_t addMaterial(const DrawMaterial& material);
+    uint32_t addMesh(const DrawMesh& mesh);
+
+    // Bindless mode: set 0 of every pipeline layout is the given global table
+    // (see BindlessTable) and materials no longer split batches. Each
+    // instance then gets two instance data values, instanceData followed by
+    // the material's bindlessIndex. Pass VK_NULL_HANDLE to go back to per
+    // material descriptor sets. Change it only while the queue is empty.
+    void setBindlessDescriptorSet(VkDescriptorSet descriptorSet);
+
+    // instanceData is forwarded to the shaders through the instance data
+    // array (typically a TransformId) and read with gl_InstanceIndex.
+    void submit(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint16_t depth, uint32_t instanceData);
+    void clear();
+
+    // Sorts the submitted draws and builds the merged batches and instance data.
+    void sort();
+
+    // Records every batch of the given pass. Material descriptor sets (or the
+    // bindless table) are bound at set index 0. sort() must have been called first.
+    void record(const VulkanDispatch& dispatch, VkCommandBuffer commandBuffer, uint32_t pass);
+
+    // Per-instance values in batch order; upload before submitting the frame.
+    // In bindless mode instance i owns elements 2 * i and 2 * i + 1.
+    const std::vector<uint32_t>& getInstanceData() const;
+    const DrawStatistics& getStatistics() const;
+
+private:
+    struct BindlessDraw {
+        uint32_t instanceData;
+        uint32_t materialIndex;
+    };
+
+    struct Batch {
+        DrawKey key;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    void radixSort();
+
+    std::vector<DrawPipeline> mPipelines;
+    std::vector<DrawMaterial> mMaterials;
+    std::vector<DrawMesh> mMeshes;
+
+    VkDescriptorSet mBindlessDescriptorSet = VK_NULL_HANDLE;
+    std::vector<BindlessDraw> mBindlessDraws;
+
+    std::vector<DrawKey> mKeys;
+    std::vector<uint32_t> mPayloads;
+    std::vector<DrawKey> mSortKeys;
+    std::vector<uint32_t> mSortPayloads;
+
+    std::vector<Batch> mBatches;
+    std::vector<uint32_t> mInstanceData;
+    DrawStatistics mStatistics;
+};
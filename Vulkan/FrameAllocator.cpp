@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "FrameAllocator.h"
+#include "MappedBuffer.h"
+#include "Renderer.h"
+
+#include <algorithm>
+#include <assert.h>
+
+FrameArena::FrameArena(size_t capacity) {
+    mCapacity = capacity;
+    mData = new uint8_t[capacity];
+}
+
+FrameArena::~FrameArena() {
+    delete[] mData;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(mData);
+    uintptr_t aligned = (base + mOffset + alignment - 1) & ~uintptr_t(alignment - 1);
+    size_t newOffset = size_t(aligned - base) + size;
+    if (newOffset > mCapacity) {
+        return nullptr;
+    }
+
+    mOffset = newOffset;
+    mHighWaterMark = std::max(mHighWaterMark, mOffset);
+    return reinterpret_cast<void*>(aligned);
+}
+
+void FrameArena::reset() {
+    mOffset = 0;
+}
+
+size_t FrameArena::getUsed() const {
+    return mOffset;
+}
+
+size_t FrameArena::getCapacity() const {
+    return mCapacity;
+}
+
+size_t FrameArena::getHighWaterMark() const {
+    return mHighWaterMark;
+}
+
+FrameUniformAllocator::FrameUniformAllocator(Renderer* renderer, VkDeviceSize bytesPerFrame, uint32_t frameSlotCount, VkBufferUsageFlags usage) {
+    const VkPhysicalDeviceLimits& limits = renderer->getPhysicalDeviceProperties().limits;
+    mAlignment = std::max<VkDeviceSize>(limits.minUniformBufferOffsetAlignment, 1);
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        mAlignment = std::max(mAlignment, limits.minStorageBufferOffsetAlignment);
+    }
+
+    // Dynamic offsets are 32-bit.
+    assert(bytesPerFrame <= UINT32_MAX);
+    mBytesPerFrame = bytesPerFrame;
+
+    for (uint32_t i = 0; i < frameSlotCount; i++) {
+        mBuffers.emplace_back(new MappedBuffer(renderer, bytesPerFrame, usage));
+    }
+}
+
+FrameUniformAllocator::~FrameUniformAllocator() {
+}
+
+void FrameUniformAllocator::beginFrame(uint32_t frameSlot) {
+    assert(frameSlot < mBuffers.size());
+    mCurrentSlot = frameSlot;
+    mOffset = 0;
+}
+
+void FrameUniformAllocator::endFrame() {
+    if (mOffset > 0) {
+        mBuffers[mCurrentSlot]->flush(0, VK_WHOLE_SIZE);
+    }
+}
+
+FrameUniformAllocation FrameUniformAllocator::allocate(uint32_t size) {
+    FrameUniformAllocation allocation;
+
+    VkDeviceSize offset = (mOffset + mAlignment - 1) & ~(mAlignment - 1);
+    if (offset + size > mBytesPerFrame) {
+        return allocation;
+    }
+    mOffset = offset + size;
+
+    MappedBuffer* buffer = mBuffers[mCurrentSlot].get();
+    allocation.data = static_cast<uint8_t*>(buffer->getMappedData()) + offset;
+    allocation.buffer = buffer->getBuffer();
+    allocation.dynamicOffset = uint32_t(offset);
+    allocation.size = size;
+    return allocation;
+}
+
+VkBuffer FrameUniformAllocator::getBuffer(uint32_t frameSlot) const {
+    assert(frameSlot < mBuffers.size());
+    return mBuffers[frameSlot]->getBuffer();
+}
+
+VkDeviceSize FrameUniformAllocator::getAlignment() const {
+    return mAlignment;
+}
+
+VkDeviceSize FrameUniformAllocator::getUsed() const {
+    return mOffset;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class MappedBuffer;
+class Renderer;
+
+// Bump allocator for CPU scratch memory that only lives for one frame. The
+// renderer owns one per frame slot and resets it once the slot's fence has
+// signaled (Renderer::getFrameArena()); allocations are never freed one by one.
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Returns nullptr when the arena is exhausted.
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void reset();
+
+    size_t getUsed() const;
+    size_t getCapacity() const;
+    size_t getHighWaterMark() const;
+
+private:
+    uint8_t* mData = nullptr;
+    size_t mCapacity = 0;
+    size_t mOffset = 0;
+    size_t mHighWaterMark = 0;
+};
+
+struct FrameUniformAllocation {
+    void* data = nullptr;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    // Pass as the dynamic offset of a UNIFORM_BUFFER_DYNAMIC / STORAGE_BUFFER_DYNAMIC binding.
+    uint32_t dynamicOffset = 0;
+    uint32_t size = 0;
+};
+
+// One large persistently mapped buffer per frame slot, sub-allocated linearly
+// for per-draw uniform data and bound with dynamic offsets. The renderer's
+// instance (Renderer::getFrameUniformAllocator()) is begun and ended around
+// every frame. Offsets are rounded
+// to minUniformBufferOffsetAlignment (and minStorageBufferOffsetAlignment when
+// the buffer is also used as a storage buffer).
+class FrameUniformAllocator {
+public:
+    FrameUniformAllocator(Renderer* renderer, VkDeviceSize bytesPerFrame, uint32_t frameSlotCount,
+                          VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    ~FrameUniformAllocator();
+
+    // Starts sub-allocating from the given slot. The caller has to make sure the
+    // GPU is done with the slot (its frame fence has signaled).
+    void beginFrame(uint32_t frameSlot);
+
+    // Flushes the written range when the memory isn't host coherent.
+    void endFrame();
+
+    // Returns an allocation with data == nullptr when the slot is full.
+    FrameUniformAllocation allocate(uint32_t size);
+
+    template <typename T>
+    FrameUniformAllocation push(const T& value) {
+        FrameUniformAllocation allocation = allocate(uint32_t(sizeof(T)));
+        if (allocation.data != nullptr) {
+            *static_cast<T*>(allocation.data) = value;
+        }
+        return allocation;
+    }
+
+    VkBuffer getBuffer(uint32_t frameSlot) const;
+    VkDeviceSize getAlignment() const;
+    VkDeviceSize getUsed() const;
+
+private:
+    std::vector<std::unique_ptr<MappedBuffer>> mBuffers;
+    VkDeviceSize mBytesPerFrame = 0;
+    VkDeviceSize mAlignment = 1;
+    VkDeviceSize mOffset = 0;
+    uint32_t mCurrentSlot = 0;
+};
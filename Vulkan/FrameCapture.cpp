@@ -0,0 +1,467 @@
+#include "stdafx.h"
+#include "FrameCapture.h"
+#include "MappedBuffer.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "Shared.h"
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// The encoders read 8-bit channels from 4 byte pixels.
+bool isSupportedFormat(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+    case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+        return true;
+    default:
+        return false;
+    }
+}
+
+VkDeviceSize getImageSize(VkExtent2D extent) {
+    return VkDeviceSize(extent.width) * extent.height * 4;
+}
+
+bool isBgraFormat(VkFormat format) {
+    return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+// Converts 4-byte pixels to tightly packed RGB.
+std::vector<uint8_t> toRgb(const CapturedFrame& frame) {
+    size_t pixelCount = size_t(frame.width) * frame.height;
+    std::vector<uint8_t> rgb(pixelCount * 3);
+    bool bgra = isBgraFormat(frame.format);
+    for (size_t i = 0; i < pixelCount; i++) {
+        const uint8_t* src = &frame.pixels[i * 4];
+        rgb[i * 3 + 0] = bgra ? src[2] : src[0];
+        rgb[i * 3 + 1] = src[1];
+        rgb[i * 3 + 2] = bgra ? src[0] : src[2];
+    }
+    return rgb;
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    // Static local initialization is thread safe; the writer threads of
+    // several FrameCaptures can encode PNGs at the same time.
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> result;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+}
+
+void appendPngChunk(std::vector<uint8_t>& out, const char type[4], const std::vector<uint8_t>& data) {
+    appendBigEndian(out, uint32_t(data.size()));
+    size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    appendBigEndian(out, crc32(&out[typeOffset], data.size() + 4));
+}
+
+// Minimal PNG writer using uncompressed (stored) deflate blocks. Captures are
+// meant to be cheap to produce; they can be recompressed offline.
+std::vector<uint8_t> encodePng(const CapturedFrame& frame) {
+    std::vector<uint8_t> rgb = toRgb(frame);
+    size_t rowSize = size_t(frame.width) * 3;
+
+    std::vector<uint8_t> scanlines;
+    scanlines.reserve((rowSize + 1) * frame.height);
+    for (uint32_t y = 0; y < frame.height; y++) {
+        scanlines.push_back(0); // filter: none
+        scanlines.insert(scanlines.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+    }
+
+    std::vector<uint8_t> zlib;
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do {
+        size_t blockSize = std::min<size_t>(scanlines.size() - offset, 65535);
+        bool last = offset + blockSize == scanlines.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(uint8_t(blockSize));
+        zlib.push_back(uint8_t(blockSize >> 8));
+        zlib.push_back(uint8_t(~blockSize));
+        zlib.push_back(uint8_t(~blockSize >> 8));
+        zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < scanlines.size());
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t value : scanlines) {
+        a = (a + value) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    appendBigEndian(header, frame.width);
+    appendBigEndian(header, frame.height);
+    header.push_back(8); // bit depth
+    header.push_back(2); // color type: RGB
+    header.push_back(0); // compression
+    header.push_back(0); // filter
+    header.push_back(0); // interlace
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<uint8_t> png(signature, signature + sizeof(signature));
+    appendPngChunk(png, "IHDR", header);
+    appendPngChunk(png, "IDAT", zlib);
+    appendPngChunk(png, "IEND", std::vector<uint8_t>());
+    return png;
+}
+
+} // namespace
+
+FrameCapture::FrameCapture(Renderer* renderer, uint32_t width, uint32_t height, uint32_t ringSize) {
+    mRenderer = renderer;
+
+    VkDevice device = mRenderer->getDevice();
+
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = mRenderer->getGraphicsQueueFamilyIndex();
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    errorCheck(vkCreateCommandPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &mCommandPool));
+
+    // Host cached memory makes the CPU reads fast; fall back to plain host visible.
+    mMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    const VkPhysicalDeviceMemoryProperties& memoryProperties = mRenderer->getPhysicalDeviceMemoryProperties();
+    bool hasCached = false;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((memoryProperties.memoryTypes[i].propertyFlags & mMemoryFlags) == mMemoryFlags) {
+            hasCached = true;
+        }
+    }
+    if (!hasCached) {
+        mMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+
+    VkExtent2D extent = { width, height };
+    mSlots.resize(ringSize);
+    for (auto& slot : mSlots) {
+        slot.buffer.reset(new MappedBuffer(mRenderer, getImageSize(extent), VK_BUFFER_USAGE_TRANSFER_DST_BIT, mMemoryFlags));
+
+        VkCommandBufferAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocateInfo.commandPool = mCommandPool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        errorCheck(vkAllocateCommandBuffers(device, &allocateInfo, &slot.commandBuffer));
+
+        VkFenceCreateInfo fenceCreateInfo{};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        errorCheck(vkCreateFence(device, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &slot.fence));
+    }
+
+    mWriterThread = std::thread(&FrameCapture::writerMain, this);
+}
+
+FrameCapture::~FrameCapture() {
+    VkDevice device = mRenderer->getDevice();
+
+    // Let copies that are still in flight land so their frames aren't lost.
+    // Copies recorded into frames have no fence of their own, so wait for the
+    // whole queue when there are any.
+    bool framesInFlight = false;
+    for (auto& slot : mSlots) {
+        if (slot.inFlight && slot.inFrame) {
+            framesInFlight = true;
+        } else if (slot.inFlight) {
+            vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        }
+    }
+    if (framesInFlight) {
+        std::lock_guard<std::mutex> queueLock(mRenderer->getQueueMutex());
+        vkQueueWaitIdle(mRenderer->getQueue());
+    }
+    collect(framesInFlight);
+
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        mWriterShouldRun = false;
+    }
+    mQueueCondition.notify_one();
+    mWriterThread.join();
+
+    for (auto& slot : mSlots) {
+        vkDestroyFence(device, slot.fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+        slot.buffer.reset();
+    }
+    vkDestroyCommandPool(device, mCommandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+}
+
+void FrameCapture::setOutput(CaptureFileFormat format, const std::string& pathPrefix) {
+    std::lock_guard<std::mutex> lock(mQueueMutex);
+    mFileFormat = format;
+    mPathPrefix = pathPrefix;
+}
+
+void FrameCapture::setCallback(std::function<void(const CapturedFrame&)> callback) {
+    std::lock_guard<std::mutex> lock(mQueueMutex);
+    mCallback = callback;
+}
+
+bool FrameCapture::capture(VkImage image, VkImageLayout currentLayout, VkFormat format, VkExtent2D extent, uint64_t frameIndex) {
+    Slot* slot = acquireSlot(format, extent);
+    if (slot == nullptr) {
+        return false;
+    }
+
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    errorCheck(dispatch.vkBeginCommandBuffer(slot->commandBuffer, &beginInfo));
+    recordCopy(slot->commandBuffer, *slot, image, currentLayout);
+    errorCheck(dispatch.vkEndCommandBuffer(slot->commandBuffer));
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot->commandBuffer;
+    {
+        std::lock_guard<std::mutex> queueLock(mRenderer->getQueueMutex());
+        errorCheck(dispatch.vkQueueSubmit(mRenderer->getQueue(), 1, &submitInfo, slot->fence));
+    }
+
+    slot->inFlight = true;
+    slot->inFrame = false;
+    slot->frameIndex = frameIndex;
+    return true;
+}
+
+bool FrameCapture::record(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout currentLayout, VkFormat format,
+                          VkExtent2D extent, uint64_t frameIndex) {
+    Slot* slot = acquireSlot(format, extent);
+    if (slot == nullptr) {
+        return false;
+    }
+
+    recordCopy(commandBuffer, *slot, image, currentLayout);
+
+    slot->inFlight = true;
+    slot->inFrame = true;
+    slot->frameIndex = frameIndex;
+    return true;
+}
+
+FrameCapture::Slot* FrameCapture::acquireSlot(VkFormat format, VkExtent2D extent) {
+    if (!isSupportedFormat(format) || extent.width == 0 || extent.height == 0) {
+        return nullptr;
+    }
+
+    Slot& slot = mSlots[mNextSlot];
+    if (slot.inFlight) {
+        mDroppedCount++;
+        return nullptr;
+    }
+    mNextSlot = (mNextSlot + 1) % mSlots.size();
+
+    // The previous buffer is only used by copies that already completed.
+    VkDeviceSize size = getImageSize(extent);
+    if (slot.buffer->getSize() < size) {
+        slot.buffer.reset(new MappedBuffer(mRenderer, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, mMemoryFlags));
+    }
+    slot.format = format;
+    slot.extent = extent;
+    return &slot;
+}
+
+void FrameCapture::recordCopy(VkCommandBuffer commandBuffer, const Slot& slot, VkImage image, VkImageLayout currentLayout) {
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toTransfer.oldLayout = currentLayout;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    toTransfer.subresourceRange.levelCount = 1;
+    toTransfer.subresourceRange.layerCount = 1;
+
+    // ALL_COMMANDS as the source stage orders the copy after every command
+    // recorded or submitted earlier on this queue, which is what renders the image.
+    dispatch.vkCmdPipelineBarrier(commandBuffer,
+                                  VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  0,
+                                  0, nullptr,
+                                  0, nullptr,
+                                  1, &toTransfer);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = slot.extent.width;
+    region.imageExtent.height = slot.extent.height;
+    region.imageExtent.depth = 1;
+    dispatch.vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                    slot.buffer->getBuffer(), 1, &region);
+
+    VkImageMemoryBarrier toOriginal = toTransfer;
+    toOriginal.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toOriginal.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    toOriginal.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toOriginal.newLayout = currentLayout;
+
+    VkBufferMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = slot.buffer->getBuffer();
+    toHost.size = VK_WHOLE_SIZE;
+
+    dispatch.vkCmdPipelineBarrier(commandBuffer,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                  0,
+                                  0, nullptr,
+                                  1, &toHost,
+                                  1, &toOriginal);
+}
+
+void FrameCapture::poll() {
+    collect(false);
+}
+
+void FrameCapture::collect(bool queueIdle) {
+    VkDevice device = mRenderer->getDevice();
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+    uint64_t completedFrameCount = mRenderer->getCompletedFrameCount();
+
+    for (auto& slot : mSlots) {
+        if (!slot.inFlight) {
+            continue;
+        }
+        if (slot.inFrame) {
+            if (!queueIdle && completedFrameCount <= slot.frameIndex) {
+                continue;
+            }
+        } else if (dispatch.vkGetFenceStatus(device, slot.fence) != VK_SUCCESS) {
+            continue;
+        }
+
+        slot.buffer->invalidate();
+
+        CapturedFrame frame;
+        frame.frameIndex = slot.frameIndex;
+        frame.width = slot.extent.width;
+        frame.height = slot.extent.height;
+        frame.format = slot.format;
+        frame.pixels.resize(size_t(getImageSize(slot.extent)));
+        std::memcpy(frame.pixels.data(), slot.buffer->getMappedData(), frame.pixels.size());
+
+        if (!slot.inFrame) {
+            errorCheck(dispatch.vkResetFences(device, 1, &slot.fence));
+        }
+        slot.inFlight = false;
+        mCapturedCount++;
+
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            mWriteQueue.push_back(std::move(frame));
+        }
+        mQueueCondition.notify_one();
+    }
+}
+
+uint64_t FrameCapture::getCapturedCount() const {
+    return mCapturedCount;
+}
+
+uint64_t FrameCapture::getDroppedCount() const {
+    return mDroppedCount;
+}
+
+void FrameCapture::writerMain() {
+    while (true) {
+        CapturedFrame frame;
+        std::function<void(const CapturedFrame&)> callback;
+        {
+            std::unique_lock<std::mutex> lock(mQueueMutex);
+            mQueueCondition.wait(lock, [this] { return !mWriterShouldRun || !mWriteQueue.empty(); });
+            if (mWriteQueue.empty()) {
+                return;
+            }
+            frame = std::move(mWriteQueue.front());
+            mWriteQueue.pop_front();
+            callback = mCallback;
+        }
+
+        writeFrame(frame);
+        if (callback) {
+            callback(frame);
+        }
+    }
+}
+
+void FrameCapture::writeFrame(const CapturedFrame& frame) {
+    CaptureFileFormat fileFormat;
+    std::string pathPrefix;
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        fileFormat = mFileFormat;
+        pathPrefix = mPathPrefix;
+    }
+    if (fileFormat == CaptureFileFormat::None) {
+        return;
+    }
+
+    std::ostringstream path;
+    path << pathPrefix << frame.frameIndex;
+
+    if (fileFormat == CaptureFileFormat::Raw) {
+        path << "_" << frame.width << "x" << frame.height << ".raw";
+        std::ofstream file(path.str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(frame.pixels.data()), frame.pixels.size());
+    } else if (fileFormat == CaptureFileFormat::PPM) {
+        path << ".ppm";
+        std::vector<uint8_t> rgb = toRgb(frame);
+        std::ofstream file(path.str(), std::ios::binary);
+        file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+        file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    } else if (fileFormat == CaptureFileFormat::PNG) {
+        path << ".png";
+        std::vector<uint8_t> png = encodePng(frame);
+        std::ofstream file(path.str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(png.data()), png.size());
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MappedBuffer;
+class Renderer;
+
+enum class CaptureFileFormat {
+    None,   // Only hand the pixels to the callback.
+    Raw,
+    PPM,
+    PNG,
+};
+
+struct CapturedFrame {
+    uint64_t frameIndex = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    // Tightly packed 4 bytes per pixel, in the image's own channel order.
+    std::vector<uint8_t> pixels;
+};
+
+// Copies rendered images into a ring of host cached readback buffers without
+// waiting on the GPU. Copies complete asynchronously; poll() picks up finished
+// ones a few frames later and hands them to a background thread that encodes
+// and writes them to disk. Only 8-bit, 4 channel color formats are supported.
+class FrameCapture {
+public:
+    // width and height size the readback buffers up front; a slot's buffer is
+    // reallocated when a larger image is captured into it.
+    FrameCapture(Renderer* renderer, uint32_t width, uint32_t height, uint32_t ringSize = 3);
+    ~FrameCapture();
+
+    void setOutput(CaptureFileFormat format, const std::string& pathPrefix);
+    // Called on the writer thread for every completed capture.
+    void setCallback(std::function<void(const CapturedFrame&)> callback);
+
+    // Submits a copy of an offscreen image on the renderer queue, ordered after
+    // the work already submitted. The image must support
+    // VK_IMAGE_USAGE_TRANSFER_SRC_BIT and is returned to currentLayout
+    // afterwards. Returns false when the format isn't supported or every
+    // readback slot is still in flight, in which case the frame is skipped
+    // rather than stalling.
+    bool capture(VkImage image, VkImageLayout currentLayout, VkFormat format, VkExtent2D extent, uint64_t frameIndex);
+
+    // Same copy, recorded into the renderer's frame command buffer so it runs
+    // before the image is presented. Call it from the renderer's frame recorded
+    // handler (see Renderer::setFrameRecordedHandler()) with the frame's index;
+    // the copy completes along with that frame.
+    bool record(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout currentLayout, VkFormat format,
+                VkExtent2D extent, uint64_t frameIndex);
+
+    // Non-blocking; collects finished copies and queues them for writing.
+    void poll();
+
+    uint64_t getCapturedCount() const;
+    uint64_t getDroppedCount() const;
+
+private:
+    struct Slot {
+        std::unique_ptr<MappedBuffer> buffer;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        bool inFlight = false;
+        // Recorded into a renderer frame rather than submitted with fence.
+        bool inFrame = false;
+        uint64_t frameIndex = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent = {};
+    };
+
+    Slot* acquireSlot(VkFormat format, VkExtent2D extent);
+    void recordCopy(VkCommandBuffer commandBuffer, const Slot& slot, VkImage image, VkImageLayout currentLayout);
+    void collect(bool queueIdle);
+    void writerMain();
+    void writeFrame(const CapturedFrame& frame);
+
+    Renderer* mRenderer = nullptr;
+    VkMemoryPropertyFlags mMemoryFlags = 0;
+
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    std::vector<Slot> mSlots;
+    uint32_t mNextSlot = 0;
+    uint64_t mCapturedCount = 0;
+    uint64_t mDroppedCount = 0;
+
+    CaptureFileFormat mFileFormat = CaptureFileFormat::None;
+    std::string mPathPrefix;
+    std::function<void(const CapturedFrame&)> mCallback;
+
+    std::thread mWriterThread;
+    std::mutex mQueueMutex;
+    std::condition_variable mQueueCondition;
+    std::deque<CapturedFrame> mWriteQueue;
+    bool mWriterShouldRun = true;
+};
@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "FramePacer.h"
+
+FramePacer::~FramePacer() {
+#if VK_USE_PLATFORM_WIN32_KHR
+    if (mTimer != NULL) {
+        CloseHandle(mTimer);
+    }
+    if (mWakeEvent != NULL) {
+        CloseHandle(mWakeEvent);
+    }
+#endif
+}
+
+void FramePacer::setTargetFrameRate(double framesPerSecond) {
+    mTargetFrameRate = framesPerSecond > 0.0 ? framesPerSecond : 0.0;
+    mFramePeriod = mTargetFrameRate > 0.0 ? int64_t(double(mTicksPerSecond) / mTargetFrameRate) : 0;
+    mNextFrameTime = now();
+}
+
+double FramePacer::getTargetFrameRate() const {
+    return mTargetFrameRate;
+}
+
+bool FramePacer::isFrameDue() const {
+    return mFramePeriod == 0 || now() >= mNextFrameTime;
+}
+
+void FramePacer::frameRendered() {
+    if (mFramePeriod == 0) {
+        return;
+    }
+
+    // Keep a steady cadence, but don't try to catch up after a long frame.
+    int64_t currentTime = now();
+    mNextFrameTime += mFramePeriod;
+    if (mNextFrameTime < currentTime) {
+        mNextFrameTime = currentTime;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Platform.h"
+
+// Paces frames to a target rate with a high resolution waitable timer and
+// lets the main loop sleep on OS events instead of spinning.
+class FramePacer {
+public:
+    FramePacer();
+    ~FramePacer();
+
+    // 0 disables pacing; frames are then only limited by presentation.
+    void setTargetFrameRate(double framesPerSecond);
+    double getTargetFrameRate() const;
+
+    bool isFrameDue() const;
+    // Call after each rendered frame to schedule the next one.
+    void frameRendered();
+
+    // Sleeps until the next frame is due or an OS message arrives, whichever
+    // comes first, so input keeps being handled while waiting.
+    void waitForFrameOrEvents();
+    // Sleeps until an OS message arrives or wake() is called. Used when
+    // there's nothing to draw.
+    void waitForEvents();
+
+    // Interrupts a wait, from any thread. Used to hand events to the render thread.
+    void wake();
+
+    // Blocks the calling thread until its OS message queue gets new messages.
+    static void waitForMessages();
+
+private:
+    int64_t now() const;
+
+    double mTargetFrameRate = 0.0;
+    int64_t mTicksPerSecond = 1;
+    int64_t mFramePeriod = 0;
+    int64_t mNextFrameTime = 0;
+
+#if VK_USE_PLATFORM_WIN32_KHR
+    HANDLE mTimer = NULL;
+    HANDLE mWakeEvent = NULL;
+#endif
+};
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "FramePacer.h"
+
+#if VK_USE_PLATFORM_WIN32_KHR
+
+// Windows 10 1803+; older systems fall back to a regular waitable timer.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+FramePacer::FramePacer() {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    mTicksPerSecond = frequency.QuadPart;
+
+    mTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (mTimer == NULL) {
+        mTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    }
+
+    mWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+}
+
+void FramePacer::waitForFrameOrEvents() {
+    int64_t remaining = mNextFrameTime - now();
+    if (mFramePeriod == 0 || remaining <= 0) {
+        return;
+    }
+
+    // Waitable timers take relative times as negative 100ns units.
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -((remaining * 10000000) / mTicksPerSecond);
+    if (mTimer != NULL && SetWaitableTimer(mTimer, &dueTime, 0, NULL, NULL, FALSE)) {
+        HANDLE handles[] = { mWakeEvent, mTimer };
+        MsgWaitForMultipleObjectsEx(2, handles, INFINITE, QS_ALLINPUT, 0);
+    } else {
+        DWORD milliseconds = DWORD((remaining * 1000) / mTicksPerSecond);
+        MsgWaitForMultipleObjectsEx(1, &mWakeEvent, milliseconds, QS_ALLINPUT, 0);
+    }
+}
+
+void FramePacer::waitForEvents() {
+    MsgWaitForMultipleObjectsEx(1, &mWakeEvent, INFINITE, QS_ALLINPUT, 0);
+}
+
+void FramePacer::wake() {
+    SetEvent(mWakeEvent);
+}
+
+void FramePacer::waitForMessages() {
+    MsgWaitForMultipleObjectsEx(0, NULL, INFINITE, QS_ALLINPUT, 0);
+}
+
+int64_t FramePacer::now() const {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+#endif
@@ -0,0 +1,488 @@
+#include "stdafx.h"
+#include "HostAllocator.h"
+#include "BUILD_OPTIONS.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Blocks of 16, 32, ... 4096 bytes. Anything bigger goes to the system heap.
+const uint32_t SIZE_CLASS_COUNT = 9;
+const size_t MIN_BLOCK_SIZE = 16;
+const size_t MAX_BLOCK_SIZE = MIN_BLOCK_SIZE << (SIZE_CLASS_COUNT - 1);
+const size_t CHUNK_SIZE = 64 * 1024;
+// Blocks moved between a thread cache and the shared pool at a time.
+const uint32_t TRANSFER_BATCH = 32;
+const uint32_t THREAD_CACHE_LIMIT = 2 * TRANSFER_BATCH;
+
+const uint8_t LARGE_ALLOCATION = 0xFF;
+const uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+const uint32_t OBJECT_TYPE_COUNT = 64;
+
+// Stored right in front of every pointer handed to Vulkan. The header region
+// is max(alignment, sizeof(AllocationHeader)) bytes so the pointer stays aligned.
+struct AllocationHeader {
+    uint64_t size;
+    uint32_t headerSize;
+    uint8_t sizeClass;
+    uint8_t scope;
+    uint16_t objectType;
+};
+static_assert(sizeof(AllocationHeader) == MIN_BLOCK_SIZE, "Header must fit the smallest alignment");
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Each thread counts into its own shard, written only by that thread with
+// plain loads and stores, so allocations never do read-modify-write operations
+// on cache lines shared with other threads. Readers sum the shards.
+struct ShardCounters {
+    std::atomic<int64_t> liveBytes{ 0 };
+    std::atomic<int64_t> liveAllocations{ 0 };
+    std::atomic<int64_t> totalAllocations{ 0 };
+    std::atomic<int64_t> internalBytes{ 0 };
+
+    static void add(std::atomic<int64_t>& counter, int64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void addTo(HostAllocator::Counters& counters) const {
+        counters.liveBytes += liveBytes.load(std::memory_order_relaxed);
+        counters.liveAllocations += liveAllocations.load(std::memory_order_relaxed);
+        counters.totalAllocations += totalAllocations.load(std::memory_order_relaxed);
+        counters.internalBytes += internalBytes.load(std::memory_order_relaxed);
+    }
+
+    void merge(const ShardCounters& other) {
+        add(liveBytes, other.liveBytes.load(std::memory_order_relaxed));
+        add(liveAllocations, other.liveAllocations.load(std::memory_order_relaxed));
+        add(totalAllocations, other.totalAllocations.load(std::memory_order_relaxed));
+        add(internalBytes, other.internalBytes.load(std::memory_order_relaxed));
+    }
+};
+
+struct CounterShard {
+    ShardCounters scopes[SCOPE_COUNT];
+    ShardCounters objectTypes[OBJECT_TYPE_COUNT];
+
+    void merge(const CounterShard& other) {
+        for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+            scopes[i].merge(other.scopes[i]);
+        }
+        for (uint32_t i = 0; i < OBJECT_TYPE_COUNT; i++) {
+            objectTypes[i].merge(other.objectTypes[i]);
+        }
+    }
+};
+
+void* systemAlloc(size_t size, size_t alignment) {
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        ptr = nullptr;
+    }
+    return ptr;
+#endif
+}
+
+void systemFree(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+size_t blockSize(uint32_t sizeClass) {
+    return MIN_BLOCK_SIZE << sizeClass;
+}
+
+uint32_t sizeClassFor(size_t size) {
+    uint32_t sizeClass = 0;
+    while (blockSize(sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+// Shared free lists, one per size class. Chunks are never returned to the
+// system; the pool lives for the whole process so that thread caches can be
+// flushed back to it during thread and static teardown.
+struct BlockPool {
+    struct SizeClass {
+        std::mutex mutex;
+        FreeBlock* head = nullptr;
+    };
+
+    SizeClass classes[SIZE_CLASS_COUNT];
+    std::atomic<int64_t> chunkBytes{ 0 };
+
+    // Counter shards of the live threads, and the totals of exited ones.
+    std::mutex shardMutex;
+    std::vector<CounterShard*> shards;
+    CounterShard exitedThreads;
+
+    void addShard(CounterShard* shard) {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        shards.push_back(shard);
+    }
+
+    void removeShard(CounterShard* shard) {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        shards.erase(std::remove(shards.begin(), shards.end(), shard), shards.end());
+        exitedThreads.merge(*shard);
+    }
+
+    HostAllocator::Counters sumScope(uint32_t scope) {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        HostAllocator::Counters counters;
+        exitedThreads.scopes[scope].addTo(counters);
+        for (CounterShard* shard : shards) {
+            shard->scopes[scope].addTo(counters);
+        }
+        return counters;
+    }
+
+    HostAllocator::Counters sumObjectType(uint32_t objectType) {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        HostAllocator::Counters counters;
+        exitedThreads.objectTypes[objectType].addTo(counters);
+        for (CounterShard* shard : shards) {
+            shard->objectTypes[objectType].addTo(counters);
+        }
+        return counters;
+    }
+
+    // Pulls up to TRANSFER_BATCH blocks, carving a new chunk when the pool is dry.
+    FreeBlock* acquire(uint32_t sizeClass, uint32_t& count) {
+        SizeClass& pool = classes[sizeClass];
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            if (pool.head != nullptr) {
+                FreeBlock* first = pool.head;
+                FreeBlock* last = first;
+                count = 1;
+                while (count < TRANSFER_BATCH && last->next != nullptr) {
+                    last = last->next;
+                    count++;
+                }
+                pool.head = last->next;
+                last->next = nullptr;
+                return first;
+            }
+        }
+
+        // Chunks are aligned to the largest block so every block is aligned to its own size.
+        char* chunk = static_cast<char*>(systemAlloc(CHUNK_SIZE, MAX_BLOCK_SIZE));
+        if (chunk == nullptr) {
+            count = 0;
+            return nullptr;
+        }
+        chunkBytes.fetch_add(int64_t(CHUNK_SIZE), std::memory_order_relaxed);
+
+        size_t size = blockSize(sizeClass);
+        count = uint32_t(CHUNK_SIZE / size);
+        for (uint32_t i = 0; i < count; i++) {
+            reinterpret_cast<FreeBlock*>(chunk + i * size)->next =
+                i + 1 < count ? reinterpret_cast<FreeBlock*>(chunk + (i + 1) * size) : nullptr;
+        }
+        return reinterpret_cast<FreeBlock*>(chunk);
+    }
+
+    void release(uint32_t sizeClass, FreeBlock* first, FreeBlock* last) {
+        SizeClass& pool = classes[sizeClass];
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        last->next = pool.head;
+        pool.head = first;
+    }
+};
+
+BlockPool& getPool() {
+    static BlockPool* pool = new BlockPool();
+    return *pool;
+}
+
+// Per thread free lists and counters, so the common alloc / free pair never
+// takes a lock or touches memory written by other threads.
+struct ThreadCache {
+    FreeBlock* heads[SIZE_CLASS_COUNT] = {};
+    uint32_t counts[SIZE_CLASS_COUNT] = {};
+    CounterShard counters;
+
+    ThreadCache() {
+        getPool().addShard(&counters);
+    }
+
+    ~ThreadCache() {
+        getPool().removeShard(&counters);
+
+        for (uint32_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+            if (heads[i] != nullptr) {
+                FreeBlock* last = heads[i];
+                while (last->next != nullptr) {
+                    last = last->next;
+                }
+                getPool().release(i, heads[i], last);
+            }
+        }
+    }
+
+    void* allocate(uint32_t sizeClass) {
+        if (heads[sizeClass] == nullptr) {
+            heads[sizeClass] = getPool().acquire(sizeClass, counts[sizeClass]);
+            if (heads[sizeClass] == nullptr) {
+                return nullptr;
+            }
+        }
+        FreeBlock* block = heads[sizeClass];
+        heads[sizeClass] = block->next;
+        counts[sizeClass]--;
+        return block;
+    }
+
+    void free(uint32_t sizeClass, void* ptr) {
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = heads[sizeClass];
+        heads[sizeClass] = block;
+        counts[sizeClass]++;
+
+        if (counts[sizeClass] > THREAD_CACHE_LIMIT) {
+            FreeBlock* first = heads[sizeClass];
+            FreeBlock* last = first;
+            for (uint32_t i = 1; i < TRANSFER_BATCH; i++) {
+                last = last->next;
+            }
+            heads[sizeClass] = last->next;
+            counts[sizeClass] -= TRANSFER_BATCH;
+            getPool().release(sizeClass, first, last);
+        }
+    }
+};
+
+thread_local ThreadCache threadCache;
+
+uint32_t objectTypeIndex(void* userData) {
+    uintptr_t type = reinterpret_cast<uintptr_t>(userData);
+    return type < OBJECT_TYPE_COUNT ? uint32_t(type) : 0;
+}
+
+AllocationHeader* getHeader(void* ptr) {
+    return reinterpret_cast<AllocationHeader*>(static_cast<char*>(ptr) - sizeof(AllocationHeader));
+}
+
+// Frees are counted by the freeing thread, so a single shard can go negative;
+// only the sums are meaningful.
+void trackAllocation(const AllocationHeader* header, int64_t sign) {
+    CounterShard& shard = threadCache.counters;
+    for (ShardCounters* counters : { &shard.scopes[header->scope], &shard.objectTypes[header->objectType] }) {
+        ShardCounters::add(counters->liveBytes, sign * int64_t(header->size));
+        ShardCounters::add(counters->liveAllocations, sign);
+        if (sign > 0) {
+            ShardCounters::add(counters->totalAllocations, 1);
+        }
+    }
+}
+
+void* VKAPI_PTR allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (size == 0) {
+        return nullptr;
+    }
+
+    size_t headerSize = std::max<size_t>(alignment, sizeof(AllocationHeader));
+    size_t totalSize = headerSize + size;
+
+    char* base;
+    uint8_t sizeClass;
+    if (totalSize <= MAX_BLOCK_SIZE) {
+        // Blocks are aligned to their size, which is at least headerSize since both
+        // are powers of two, so base + headerSize keeps the requested alignment.
+        sizeClass = uint8_t(sizeClassFor(totalSize));
+        base = static_cast<char*>(threadCache.allocate(sizeClass));
+    } else {
+        sizeClass = LARGE_ALLOCATION;
+        base = static_cast<char*>(systemAlloc(totalSize, headerSize));
+    }
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    char* ptr = base + headerSize;
+    AllocationHeader* header = getHeader(ptr);
+    header->size = size;
+    header->headerSize = uint32_t(headerSize);
+    header->sizeClass = sizeClass;
+    header->scope = uint8_t(scope);
+    header->objectType = uint16_t(objectTypeIndex(userData));
+    trackAllocation(header, 1);
+    return ptr;
+}
+
+void VKAPI_PTR freeCallback(void*, void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    AllocationHeader* header = getHeader(ptr);
+    trackAllocation(header, -1);
+
+    char* base = static_cast<char*>(ptr) - header->headerSize;
+    if (header->sizeClass == LARGE_ALLOCATION) {
+        systemFree(base);
+    } else {
+        threadCache.free(header->sizeClass, base);
+    }
+}
+
+void* VKAPI_PTR reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (original == nullptr) {
+        return allocationCallback(userData, size, alignment, scope);
+    }
+    if (size == 0) {
+        freeCallback(userData, original);
+        return nullptr;
+    }
+
+    AllocationHeader* header = getHeader(original);
+    // Grow or shrink in place while the block still fits.
+    if (header->sizeClass != LARGE_ALLOCATION && header->headerSize + size <= blockSize(header->sizeClass)) {
+        trackAllocation(header, -1);
+        header->size = size;
+        trackAllocation(header, 1);
+        return original;
+    }
+
+    void* ptr = allocationCallback(userData, size, alignment, scope);
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+    memcpy(ptr, original, size_t(std::min<uint64_t>(header->size, size)));
+    freeCallback(userData, original);
+    return ptr;
+}
+
+void VKAPI_PTR internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    CounterShard& shard = threadCache.counters;
+    ShardCounters::add(shard.scopes[scope].internalBytes, int64_t(size));
+    ShardCounters::add(shard.objectTypes[objectTypeIndex(userData)].internalBytes, int64_t(size));
+}
+
+void VKAPI_PTR internalFreeCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+    CounterShard& shard = threadCache.counters;
+    ShardCounters::add(shard.scopes[scope].internalBytes, -int64_t(size));
+    ShardCounters::add(shard.objectTypes[objectTypeIndex(userData)].internalBytes, -int64_t(size));
+}
+
+struct CallbackTable {
+    VkAllocationCallbacks callbacks[OBJECT_TYPE_COUNT];
+
+    CallbackTable() {
+        for (uint32_t i = 0; i < OBJECT_TYPE_COUNT; i++) {
+            // The object type rides in pUserData so the callbacks can attribute allocations.
+            callbacks[i].pUserData = reinterpret_cast<void*>(uintptr_t(i));
+            callbacks[i].pfnAllocation = allocationCallback;
+            callbacks[i].pfnReallocation = reallocationCallback;
+            callbacks[i].pfnFree = freeCallback;
+            callbacks[i].pfnInternalAllocation = internalAllocationCallback;
+            callbacks[i].pfnInternalFree = internalFreeCallback;
+        }
+    }
+};
+
+const char* scopeName(uint32_t scope) {
+    switch (scope) {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:  return "command";
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:   return "object";
+    case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:    return "cache";
+    case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:   return "device";
+    case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+    default:                                  return "unknown";
+    }
+}
+
+const char* objectTypeName(uint32_t objectType) {
+    switch (objectType) {
+    case VK_DEBUG_REPORT_OBJECT_TYPE_INSTANCE_EXT:              return "instance";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_EXT:                return "device";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT:             return "semaphore";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_BUFFER_EXT:        return "command buffer";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT:                 return "fence";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_MEMORY_EXT:         return "device memory";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT:                return "buffer";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT:                 return "image";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_EVENT_EXT:                 return "event";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_QUERY_POOL_EXT:            return "query pool";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_VIEW_EXT:           return "buffer view";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_VIEW_EXT:            return "image view";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT:         return "shader module";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_CACHE_EXT:        return "pipeline cache";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_LAYOUT_EXT:       return "pipeline layout";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_RENDER_PASS_EXT:           return "render pass";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT:              return "pipeline";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT_EXT: return "descriptor set layout";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_SAMPLER_EXT:               return "sampler";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_DESCRIPTOR_POOL_EXT:       return "descriptor pool";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_FRAMEBUFFER_EXT:           return "framebuffer";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT:          return "command pool";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_SURFACE_KHR_EXT:           return "surface";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_SWAPCHAIN_KHR_EXT:         return "swapchain";
+    case VK_DEBUG_REPORT_OBJECT_TYPE_DEBUG_REPORT_EXT:          return "debug report";
+    default:                                                    return "other";
+    }
+}
+
+} // namespace
+
+const VkAllocationCallbacks* HostAllocator::getCallbacks(VkDebugReportObjectTypeEXT objectType) {
+#if BUILD_ENABLE_VULKAN_HOST_ALLOCATOR
+    static const CallbackTable table;
+    return &table.callbacks[objectTypeIndex(reinterpret_cast<void*>(uintptr_t(objectType)))];
+#else
+    (void)objectType;
+    return nullptr;
+#endif
+}
+
+HostAllocator::Counters HostAllocator::getScopeCounters(VkSystemAllocationScope scope) {
+    return uint32_t(scope) < SCOPE_COUNT ? getPool().sumScope(scope) : Counters();
+}
+
+HostAllocator::Counters HostAllocator::getObjectTypeCounters(VkDebugReportObjectTypeEXT objectType) {
+    return uint32_t(objectType) < OBJECT_TYPE_COUNT ? getPool().sumObjectType(objectType) : Counters();
+}
+
+void HostAllocator::printStatistics() {
+    BlockPool& pool = getPool();
+    printf("Host allocations (%lld KiB in pool chunks):\n",
+        (long long)(pool.chunkBytes.load(std::memory_order_relaxed) / 1024));
+
+    printf("  By scope:\n");
+    for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+        Counters counters = pool.sumScope(i);
+        if (counters.totalAllocations == 0 && counters.internalBytes == 0) {
+            continue;
+        }
+        printf("    %-22s live %8lld B in %6lld | total %8lld | internal %8lld B\n",
+            scopeName(i), (long long)counters.liveBytes, (long long)counters.liveAllocations,
+            (long long)counters.totalAllocations, (long long)counters.internalBytes);
+    }
+
+    printf("  By object type:\n");
+    for (uint32_t i = 0; i < OBJECT_TYPE_COUNT; i++) {
+        Counters counters = pool.sumObjectType(i);
+        if (counters.totalAllocations == 0 && counters.internalBytes == 0) {
+            continue;
+        }
+        printf("    %-22s live %8lld B in %6lld | total %8lld | internal %8lld B\n",
+            objectTypeName(i), (long long)counters.liveBytes, (long long)counters.liveAllocations,
+            (long long)counters.totalAllocations, (long long)counters.internalBytes);
+    }
+}
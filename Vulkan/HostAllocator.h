@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+
+// VkAllocationCallbacks backed by size-class pools with thread local caches,
+// so driver host allocations don't contend on the system heap. Every
+// allocation is tagged with its VkSystemAllocationScope and with the object
+// type it was created for, and live counts are kept for both.
+class HostAllocator {
+public:
+    struct Counters {
+        int64_t liveBytes = 0;
+        int64_t liveAllocations = 0;
+        int64_t totalAllocations = 0;
+        int64_t internalBytes = 0;
+    };
+
+    // Callbacks to pass to vkCreate*/vkDestroy* for an object of the given type.
+    // Returns nullptr when BUILD_ENABLE_VULKAN_HOST_ALLOCATOR is off, which
+    // makes Vulkan use its default allocator.
+    static const VkAllocationCallbacks* getCallbacks(VkDebugReportObjectTypeEXT objectType);
+
+    static Counters getScopeCounters(VkSystemAllocationScope scope);
+    static Counters getObjectTypeCounters(VkDebugReportObjectTypeEXT objectType);
+    static void printStatistics();
+};
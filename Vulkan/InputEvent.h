@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+class Window;
+
+enum class InputEventType {
+    KeyDown,
+    KeyUp,
+    Char,
+    MouseMove,
+    MouseButtonDown,
+    MouseButtonUp,
+    MouseWheel,
+    Resize,
+    Expose,
+    Close,
+};
+
+// Posted by the OS message pump, consumed by the render thread.
+struct InputEvent {
+    InputEventType type = InputEventType::MouseMove;
+    Window* window = nullptr;
+    // Key code / character / mouse button, or width for Resize.
+    int32_t a = 0;
+    // Wheel delta, or height for Resize. Mouse events carry the cursor in x/y.
+    int32_t b = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+    // Steady clock nanoseconds when the event was received from the OS.
+    uint64_t timestamp = 0;
+};
+
+inline uint64_t inputTimestampNow() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
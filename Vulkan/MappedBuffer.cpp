@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "MappedBuffer.h"
+#include "Renderer.h"
+#include "DeletionQueue.h"
+#include "HostAllocator.h"
+#include "MemoryBudget.h"
+#include "Shared.h"
+
+MappedBuffer::MappedBuffer(Renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags) {
+    mRenderer = renderer;
+    mSize = size;
+
+    VkDevice device = mRenderer->getDevice();
+
+    VkBufferCreateInfo bufferCreateInfo{};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = usage;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    errorCheck(vkCreateBuffer(device, &bufferCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT), &mBuffer));
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, mBuffer, &requirements);
+
+    VkMemoryAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = requirements.size;
+    allocateInfo.memoryTypeIndex = mRenderer->findMemoryTypeIndex(requirements.memoryTypeBits, memoryFlags);
+    errorCheck(mRenderer->getMemoryBudget().allocate(allocateInfo, &mMemory));
+    mMemoryTypeIndex = allocateInfo.memoryTypeIndex;
+    mAllocationSize = allocateInfo.allocationSize;
+    errorCheck(vkBindBufferMemory(device, mBuffer, mMemory, 0));
+
+    const VkPhysicalDeviceMemoryProperties& memoryProperties = mRenderer->getPhysicalDeviceMemoryProperties();
+    mCoherent = (memoryProperties.memoryTypes[allocateInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    errorCheck(vkMapMemory(device, mMemory, 0, VK_WHOLE_SIZE, 0, &mMappedData));
+}
+
+MappedBuffer::~MappedBuffer() {
+    VkDevice device = mRenderer->getDevice();
+    vkUnmapMemory(device, mMemory);
+    // The GPU may still be reading from it; let the deletion queue free it later.
+    mRenderer->getDeletionQueue().retireBuffer(mBuffer);
+    mRenderer->getDeletionQueue().retireMemory(mMemory, mMemoryTypeIndex, mAllocationSize);
+}
+
+void MappedBuffer::flush(VkDeviceSize offset, VkDeviceSize size) {
+    if (mCoherent) {
+        return;
+    }
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = mMemory;
+    range.offset = offset;
+    range.size = size;
+    errorCheck(mRenderer->getDispatch().vkFlushMappedMemoryRanges(mRenderer->getDevice(), 1, &range));
+}
+
+void MappedBuffer::invalidate(VkDeviceSize offset, VkDeviceSize size) {
+    if (mCoherent) {
+        return;
+    }
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = mMemory;
+    range.offset = offset;
+    range.size = size;
+    errorCheck(mRenderer->getDispatch().vkInvalidateMappedMemoryRanges(mRenderer->getDevice(), 1, &range));
+}
+
+VkBuffer MappedBuffer::getBuffer() const {
+    return mBuffer;
+}
+
+VkDeviceMemory MappedBuffer::getMemory() const {
+    return mMemory;
+}
+
+VkDeviceSize MappedBuffer::getSize() const {
+    return mSize;
+}
+
+void* MappedBuffer::getMappedData() const {
+    return mMappedData;
+}
+
+bool MappedBuffer::isCoherent() const {
+    return mCoherent;
+}
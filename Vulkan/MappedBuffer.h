@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Platform.h"
+
+class Renderer;
+
+// VkBuffer in host visible memory that stays mapped for its whole lifetime.
+// The buffer and its memory are released through the renderer's DeletionQueue.
+class MappedBuffer {
+public:
+    MappedBuffer(Renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage,
+                 VkMemoryPropertyFlags memoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    ~MappedBuffer();
+
+    MappedBuffer(const MappedBuffer&) = delete;
+    MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+    // Only needed when the memory isn't host coherent.
+    void flush(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void invalidate(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+    VkBuffer getBuffer() const;
+    VkDeviceMemory getMemory() const;
+    VkDeviceSize getSize() const;
+    void* getMappedData() const;
+    bool isCoherent() const;
+
+private:
+    Renderer* mRenderer = nullptr;
+
+    VkBuffer mBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory mMemory = VK_NULL_HANDLE;
+    uint32_t mMemoryTypeIndex = 0;
+    VkDeviceSize mAllocationSize = 0;
+    VkDeviceSize mSize = 0;
+    void* mMappedData = nullptr;
+    bool mCoherent = false;
+};
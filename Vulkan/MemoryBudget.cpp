@@ -0,0 +1,246 @@
+#include "stdafx.h"
+#include "MemoryBudget.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace {
+
+// Budget assumed for a heap when the driver can't tell us.
+const double DEFAULT_BUDGET_FRACTION = 0.8;
+
+double toMiB(VkDeviceSize bytes) {
+    return double(bytes) / (1024.0 * 1024.0);
+}
+
+// Usage that eviction can still do something about.
+VkDeviceSize getEvictableUsage(const MemoryHeapBudget& heap) {
+    return heap.usage - std::min(heap.usage, heap.pendingFreeBytes);
+}
+
+} // namespace
+
+MemoryBudget::MemoryBudget(Renderer* renderer, bool budgetExtensionEnabled) {
+    mRenderer = renderer;
+
+#ifdef VK_EXT_memory_budget
+    if (budgetExtensionEnabled) {
+        mBudgetExtensionEnabled = mRenderer->getDispatch().vkGetPhysicalDeviceMemoryProperties2KHR != nullptr;
+    }
+#else
+    (void)budgetExtensionEnabled;
+#endif
+
+    const VkPhysicalDeviceMemoryProperties& memoryProperties = mRenderer->getPhysicalDeviceMemoryProperties();
+    mHeaps.resize(memoryProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        mHeaps[i].size = memoryProperties.memoryHeaps[i].size;
+        mHeaps[i].flags = memoryProperties.memoryHeaps[i].flags;
+    }
+    queryHeaps();
+
+    printf("Memory budget: %s\n", mBudgetExtensionEnabled ? "VK_EXT_memory_budget" : "estimated from heap sizes");
+}
+
+void MemoryBudget::queryHeaps() {
+#ifdef VK_EXT_memory_budget
+    if (mBudgetExtensionEnabled) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2KHR memoryProperties{};
+        memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        memoryProperties.pNext = &budgetProperties;
+        mRenderer->getDispatch().vkGetPhysicalDeviceMemoryProperties2KHR(mRenderer->getPhysicalDevice(), &memoryProperties);
+
+        for (uint32_t i = 0; i < mHeaps.size(); i++) {
+            mHeaps[i].budget = budgetProperties.heapBudget[i];
+            mHeaps[i].usage = budgetProperties.heapUsage[i];
+        }
+        return;
+    }
+#endif
+
+    for (auto& heap : mHeaps) {
+        heap.budget = VkDeviceSize(double(heap.size) * DEFAULT_BUDGET_FRACTION);
+        heap.usage = heap.trackedUsage;
+    }
+}
+
+void MemoryBudget::update(uint64_t frameIndex) {
+    std::vector<std::pair<uint32_t, VkDeviceSize>> evictions;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        queryHeaps();
+
+        for (uint32_t i = 0; i < mHeaps.size(); i++) {
+            MemoryHeapBudget& heap = mHeaps[i];
+            VkDeviceSize usage = getEvictableUsage(heap);
+            bool underPressure = double(usage) > double(heap.budget) * mEvictionThreshold;
+            if (underPressure != heap.underPressure) {
+                heap.underPressure = underPressure;
+                printf("Memory heap %u %s budget pressure:", i, underPressure ? "entered" : "left");
+                printHeap(heap);
+            } else if (mLogInterval != 0 && frameIndex % mLogInterval == 0) {
+                printf("Memory heap %u:", i);
+                printHeap(heap);
+            }
+
+            if (underPressure) {
+                VkDeviceSize target = VkDeviceSize(double(heap.budget) * mEvictionTarget);
+                evictions.push_back({ i, usage - std::min(usage, target) });
+            }
+        }
+    }
+
+    // Handlers release memory through free() or retire(), which take the lock,
+    // so they run without it held.
+    for (auto& eviction : evictions) {
+        evict(eviction.first, eviction.second);
+    }
+}
+
+uint32_t MemoryBudget::addEvictionHandler(int priority, EvictionHandler handler) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    HandlerEntry entry{ mNextHandlerId++, priority, handler };
+    auto it = std::upper_bound(mHandlers.begin(), mHandlers.end(), priority,
+        [](int p, const HandlerEntry& e) { return p < e.priority; });
+    mHandlers.insert(it, entry);
+    return entry.id;
+}
+
+void MemoryBudget::removeEvictionHandler(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHandlers.erase(std::remove_if(mHandlers.begin(), mHandlers.end(),
+        [id](const HandlerEntry& e) { return e.id == id; }), mHandlers.end());
+}
+
+void MemoryBudget::setEvictionThresholds(float threshold, float target) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEvictionThreshold = threshold;
+    mEvictionTarget = std::min(target, threshold);
+}
+
+void MemoryBudget::setLogInterval(uint64_t frameInterval) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLogInterval = frameInterval;
+}
+
+VkDeviceSize MemoryBudget::evict(uint32_t heapIndex, VkDeviceSize bytesToFree) {
+    if (bytesToFree == 0) {
+        return 0;
+    }
+
+    std::vector<HandlerEntry> handlers;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        handlers = mHandlers;
+    }
+
+    VkDeviceSize freed = 0;
+    for (auto& entry : handlers) {
+        if (freed >= bytesToFree) {
+            break;
+        }
+        freed += entry.handler(heapIndex, bytesToFree - freed);
+    }
+
+    // Usage itself drops as the handlers release memory through free(), or
+    // stops counting towards eviction once retired to the DeletionQueue.
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHeaps[heapIndex].evictedBytes += freed;
+    return freed;
+}
+
+VkResult MemoryBudget::allocate(const VkMemoryAllocateInfo& allocateInfo, VkDeviceMemory* memory) {
+    uint32_t heapIndex = getHeapIndex(allocateInfo.memoryTypeIndex);
+
+    VkDeviceSize bytesToFree = 0;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const MemoryHeapBudget& heap = mHeaps[heapIndex];
+        double limit = double(heap.budget) * mEvictionThreshold;
+        VkDeviceSize needed = getEvictableUsage(heap) + allocateInfo.allocationSize;
+        if (double(needed) > limit) {
+            VkDeviceSize target = VkDeviceSize(double(heap.budget) * mEvictionTarget);
+            bytesToFree = needed - std::min(needed, target);
+        }
+    }
+    evict(heapIndex, bytesToFree);
+
+    const VkAllocationCallbacks* callbacks = HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_MEMORY_EXT);
+    VkResult result = vkAllocateMemory(mRenderer->getDevice(), &allocateInfo, callbacks, memory);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY) {
+        // Last resort: free at least the requested size and try again once.
+        evict(heapIndex, allocateInfo.allocationSize);
+        result = vkAllocateMemory(mRenderer->getDevice(), &allocateInfo, callbacks, memory);
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    MemoryHeapBudget& heap = mHeaps[heapIndex];
+    if (result != VK_SUCCESS) {
+        printf("Memory heap %u failed to allocate %.1f MiB:", heapIndex, toMiB(allocateInfo.allocationSize));
+        printHeap(heap);
+        return result;
+    }
+
+    heap.trackedUsage += allocateInfo.allocationSize;
+    heap.allocationCount++;
+    heap.usage += allocateInfo.allocationSize;
+    return result;
+}
+
+void MemoryBudget::free(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size) {
+    vkFreeMemory(mRenderer->getDevice(), memory, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_MEMORY_EXT));
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    MemoryHeapBudget& heap = mHeaps[getHeapIndex(memoryTypeIndex)];
+    heap.trackedUsage -= std::min(heap.trackedUsage, size);
+    heap.allocationCount--;
+    heap.usage -= std::min(heap.usage, size);
+}
+
+void MemoryBudget::retire(uint32_t memoryTypeIndex, VkDeviceSize size) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHeaps[getHeapIndex(memoryTypeIndex)].pendingFreeBytes += size;
+}
+
+void MemoryBudget::freeRetired(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        MemoryHeapBudget& heap = mHeaps[getHeapIndex(memoryTypeIndex)];
+        heap.pendingFreeBytes -= std::min(heap.pendingFreeBytes, size);
+    }
+    free(memory, memoryTypeIndex, size);
+}
+
+uint32_t MemoryBudget::getHeapIndex(uint32_t memoryTypeIndex) const {
+    return mRenderer->getPhysicalDeviceMemoryProperties().memoryTypes[memoryTypeIndex].heapIndex;
+}
+
+bool MemoryBudget::hasBudgetExtension() const {
+    return mBudgetExtensionEnabled;
+}
+
+std::vector<MemoryHeapBudget> MemoryBudget::getHeaps() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHeaps;
+}
+
+void MemoryBudget::print() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    printf("Memory heaps:\n");
+    for (uint32_t i = 0; i < mHeaps.size(); i++) {
+        printf("  %u:", i);
+        printHeap(mHeaps[i]);
+    }
+}
+
+void MemoryBudget::printHeap(const MemoryHeapBudget& heap) const {
+    double percent = heap.budget > 0 ? 100.0 * double(heap.usage) / double(heap.budget) : 0.0;
+    printf(" %s %.1f / %.1f MiB (%.0f%% of budget, heap %.1f MiB, %u tracked allocations %.1f MiB, %.1f MiB pending free, %.1f MiB evicted)\n",
+        (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "device" : "host",
+        toMiB(heap.usage), toMiB(heap.budget), percent, toMiB(heap.size),
+        heap.allocationCount, toMiB(heap.trackedUsage), toMiB(heap.pendingFreeBytes), toMiB(heap.evictedBytes));
+}
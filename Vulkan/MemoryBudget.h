@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class Renderer;
+
+struct MemoryHeapBudget {
+    VkDeviceSize size = 0;
+    VkMemoryHeapFlags flags = 0;
+    // From VK_EXT_memory_budget when available, otherwise a fixed fraction of
+    // the heap size and the bytes allocated through this tracker.
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage = 0;
+    // Bytes allocated through allocate(), whether or not the extension is present.
+    VkDeviceSize trackedUsage = 0;
+    uint32_t allocationCount = 0;
+    // Retired to the DeletionQueue but not freed yet. Still part of usage,
+    // but left out when working out how much to evict.
+    VkDeviceSize pendingFreeBytes = 0;
+    uint64_t evictedBytes = 0;
+    bool underPressure = false;
+};
+
+// Tracks per heap device memory usage against its budget, refreshed once per
+// frame, and asks registered eviction handlers to release memory before the
+// budget runs out instead of waiting for VK_ERROR_OUT_OF_DEVICE_MEMORY.
+class MemoryBudget {
+public:
+    // Asked to release roughly bytesToFree from the heap; returns the bytes actually freed.
+    typedef std::function<VkDeviceSize(uint32_t heapIndex, VkDeviceSize bytesToFree)> EvictionHandler;
+
+    MemoryBudget(Renderer* renderer, bool budgetExtensionEnabled);
+
+    // Queries the heaps, logs pressure changes and evicts when a heap is past
+    // the eviction threshold. Called by the renderer at the start of each frame.
+    void update(uint64_t frameIndex);
+
+    // Handlers with a lower priority are asked first, e.g. texture mips before cached buffers.
+    uint32_t addEvictionHandler(int priority, EvictionHandler handler);
+    void removeEvictionHandler(uint32_t id);
+
+    // Eviction starts when usage goes past threshold * budget and stops at target * budget.
+    void setEvictionThresholds(float threshold, float target);
+    // Logs every heap each frameInterval frames; 0 only logs pressure changes.
+    void setLogInterval(uint64_t frameInterval);
+
+    // vkAllocateMemory that makes room first when the allocation would push the
+    // heap past its threshold, and evicts and retries once on out of device memory.
+    VkResult allocate(const VkMemoryAllocateInfo& allocateInfo, VkDeviceMemory* memory);
+    void free(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size);
+    // For memory going through the DeletionQueue: retire() when it is queued,
+    // so eviction handlers aren't asked for the same bytes again every frame,
+    // and freeRetired() when it is finally destroyed.
+    void retire(uint32_t memoryTypeIndex, VkDeviceSize size);
+    void freeRetired(VkDeviceMemory memory, uint32_t memoryTypeIndex, VkDeviceSize size);
+
+    bool hasBudgetExtension() const;
+    std::vector<MemoryHeapBudget> getHeaps() const;
+    void print() const;
+
+private:
+    struct HandlerEntry {
+        uint32_t id;
+        int priority;
+        EvictionHandler handler;
+    };
+
+    void queryHeaps();
+    uint32_t getHeapIndex(uint32_t memoryTypeIndex) const;
+    VkDeviceSize evict(uint32_t heapIndex, VkDeviceSize bytesToFree);
+    void printHeap(const MemoryHeapBudget& heap) const;
+
+    Renderer* mRenderer = nullptr;
+    bool mBudgetExtensionEnabled = false;
+    float mEvictionThreshold = 0.9f;
+    float mEvictionTarget = 0.8f;
+    uint64_t mLogInterval = 0;
+
+    mutable std::mutex mMutex;
+    std::vector<MemoryHeapBudget> mHeaps;
+    std::vector<HandlerEntry> mHandlers;
+    uint32_t mNextHandlerId = 1;
+};
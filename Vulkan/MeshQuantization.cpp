@@ -0,0 +1,607 @@
+#include "stdafx.h"
+#include "MeshQuantization.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "MappedBuffer.h"
+#include "MemoryBudget.h"
+#include "Shared.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+namespace {
+
+float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+uint16_t quantizeUnorm16(float value) {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return uint16_t(value * 65535.0f + 0.5f);
+}
+
+int16_t quantizeSnorm16(float value) {
+    value = std::min(std::max(value, -1.0f), 1.0f);
+    return int16_t(std::floor(value * 32767.0f + 0.5f));
+}
+
+float dequantizeSnorm16(int16_t value) {
+    return std::max(float(value) / 32767.0f, -1.0f);
+}
+
+void buildBenchmarkGrid(uint32_t gridSize, std::vector<MeshVertex>& vertices, std::vector<uint32_t>& indices) {
+    uint32_t rowSize = gridSize + 1;
+    vertices.resize(size_t(rowSize) * rowSize);
+    for (uint32_t y = 0; y < rowSize; y++) {
+        for (uint32_t x = 0; x < rowSize; x++) {
+            // Height field z = sin(x / 8) * cos(y / 8) over a unit spaced grid.
+            float fx = float(x) / 8.0f;
+            float fy = float(y) / 8.0f;
+            float dzdx = std::cos(fx) * std::cos(fy) / 8.0f;
+            float dzdy = -std::sin(fx) * std::sin(fy) / 8.0f;
+            float normalLength = std::sqrt(dzdx * dzdx + dzdy * dzdy + 1.0f);
+            float tangentLength = std::sqrt(dzdx * dzdx + 1.0f);
+
+            MeshVertex& vertex = vertices[size_t(y) * rowSize + x];
+            vertex.position[0] = float(x);
+            vertex.position[1] = float(y);
+            vertex.position[2] = std::sin(fx) * std::cos(fy);
+            vertex.normal[0] = -dzdx / normalLength;
+            vertex.normal[1] = -dzdy / normalLength;
+            vertex.normal[2] = 1.0f / normalLength;
+            vertex.tangent[0] = 1.0f / tangentLength;
+            vertex.tangent[1] = 0.0f;
+            vertex.tangent[2] = dzdx / tangentLength;
+            vertex.tangent[3] = 1.0f;
+            vertex.uv[0] = float(x) / float(gridSize);
+            vertex.uv[1] = float(y) / float(gridSize);
+        }
+    }
+
+    std::vector<uint32_t> quads(size_t(gridSize) * gridSize);
+    for (uint32_t i = 0; i < quads.size(); i++) {
+        quads[i] = i;
+    }
+    std::mt19937 random(1234);
+    std::shuffle(quads.begin(), quads.end(), random);
+
+    indices.clear();
+    indices.reserve(quads.size() * 6);
+    for (uint32_t quad : quads) {
+        uint32_t corner = (quad / gridSize) * rowSize + quad % gridSize;
+        uint32_t quadIndices[6] = { corner, corner + 1, corner + rowSize, corner + 1, corner + rowSize + 1, corner + rowSize };
+        indices.insert(indices.end(), quadIndices, quadIndices + 6);
+    }
+}
+
+// Average time to copy data into a staging buffer and from there into a
+// device local vertex buffer, waiting for the GPU each time.
+double timeVertexUpload(Renderer* renderer, VkCommandBuffer commandBuffer, VkFence fence,
+                        const void* data, VkDeviceSize size, uint32_t iterations) {
+    VkDevice device = renderer->getDevice();
+    const VulkanDispatch& dispatch = renderer->getDispatch();
+
+    MappedBuffer staging(renderer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+    VkBufferCreateInfo bufferCreateInfo{};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    errorCheck(vkCreateBuffer(device, &bufferCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT), &buffer));
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    VkMemoryAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = requirements.size;
+    allocateInfo.memoryTypeIndex = renderer->findMemoryTypeIndex(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    errorCheck(renderer->getMemoryBudget().allocate(allocateInfo, &memory));
+    errorCheck(vkBindBufferMemory(device, buffer, memory, 0));
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkBufferCopy region{};
+    region.size = size;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    double seconds = 0.0;
+    // One extra untimed upload warms up the memory.
+    for (uint32_t i = 0; i <= iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        std::memcpy(staging.getMappedData(), data, size_t(size));
+        staging.flush();
+
+        errorCheck(dispatch.vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        dispatch.vkCmdCopyBuffer(commandBuffer, staging.getBuffer(), buffer, 1, &region);
+        errorCheck(dispatch.vkEndCommandBuffer(commandBuffer));
+        uint64_t submitSerial;
+        {
+            std::lock_guard<std::mutex> queueLock(renderer->getQueueMutex());
+            submitSerial = renderer->beginSubmit();
+            errorCheck(dispatch.vkQueueSubmit(renderer->getQueue(), 1, &submitInfo, fence));
+        }
+        errorCheck(dispatch.vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+        errorCheck(dispatch.vkResetFences(device, 1, &fence));
+        renderer->completeSubmit(submitSerial);
+        if (i > 0) {
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    // Every copy was waited on, so nothing is using the buffer anymore.
+    vkDestroyBuffer(device, buffer, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT));
+    renderer->getMemoryBudget().free(memory, allocateInfo.memoryTypeIndex, allocateInfo.allocationSize);
+    return seconds * 1000.0 / iterations;
+}
+
+// Tuned for hardware caches of 16 to 32 entries.
+const uint32_t VERTEX_CACHE_SIZE = 32;
+
+float vertexCacheScore(int32_t cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The vertices of the last triangle get a fixed score so the next
+        // triangle doesn't simply reuse its most recent edge.
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float scaler = 1.0f / float(VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - float(cachePosition - 3) * scaler, 1.5f);
+        }
+    }
+    // Finish vertices with few triangles left so they can leave the cache.
+    score += 2.0f / std::sqrt(float(remainingTriangles));
+    return score;
+}
+
+}
+
+QuantizationBounds computeQuantizationBounds(const MeshVertex* vertices, size_t vertexCount) {
+    float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < vertexCount; i++) {
+        for (int c = 0; c < 3; c++) {
+            minimum[c] = std::min(minimum[c], vertices[i].position[c]);
+            maximum[c] = std::max(maximum[c], vertices[i].position[c]);
+        }
+    }
+
+    QuantizationBounds bounds;
+    for (int c = 0; c < 3; c++) {
+        bounds.min[c] = vertexCount ? minimum[c] : 0.0f;
+        bounds.scale[c] = vertexCount ? maximum[c] - minimum[c] : 0.0f;
+    }
+    return bounds;
+}
+
+void quantizeVertices(const MeshVertex* vertices, size_t vertexCount, const QuantizationBounds& bounds, QuantizedVertex* quantized) {
+    float inverseScale[3];
+    for (int c = 0; c < 3; c++) {
+        inverseScale[c] = bounds.scale[c] > 0.0f ? 1.0f / bounds.scale[c] : 0.0f;
+    }
+
+    for (size_t i = 0; i < vertexCount; i++) {
+        const MeshVertex& vertex = vertices[i];
+        QuantizedVertex& out = quantized[i];
+        for (int c = 0; c < 3; c++) {
+            out.position[c] = quantizeUnorm16((vertex.position[c] - bounds.min[c]) * inverseScale[c]);
+        }
+        out.position[3] = vertex.tangent[3] < 0.0f ? 0 : 65535;
+        encodeOctahedral(vertex.normal, out.normal);
+        encodeOctahedral(vertex.tangent, out.tangent);
+        out.uv[0] = floatToHalf(vertex.uv[0]);
+        out.uv[1] = floatToHalf(vertex.uv[1]);
+    }
+}
+
+void dequantizeVertex(const QuantizedVertex& quantized, const QuantizationBounds& bounds, MeshVertex& vertex) {
+    for (int c = 0; c < 3; c++) {
+        vertex.position[c] = bounds.min[c] + float(quantized.position[c]) / 65535.0f * bounds.scale[c];
+    }
+    decodeOctahedral(quantized.normal, vertex.normal);
+    decodeOctahedral(quantized.tangent, vertex.tangent);
+    vertex.tangent[3] = quantized.position[3] >= 32768 ? 1.0f : -1.0f;
+    vertex.uv[0] = halfToFloat(quantized.uv[0]);
+    vertex.uv[1] = halfToFloat(quantized.uv[1]);
+}
+
+void getDequantizationMatrix(const QuantizationBounds& bounds, float matrix[16]) {
+    std::memset(matrix, 0, sizeof(float) * 16);
+    matrix[0] = bounds.scale[0];
+    matrix[5] = bounds.scale[1];
+    matrix[10] = bounds.scale[2];
+    matrix[12] = bounds.min[0];
+    matrix[13] = bounds.min[1];
+    matrix[14] = bounds.min[2];
+    matrix[15] = 1.0f;
+}
+
+void encodeOctahedral(const float direction[3], int16_t encoded[2]) {
+    float length = std::abs(direction[0]) + std::abs(direction[1]) + std::abs(direction[2]);
+    if (length == 0.0f) {
+        encoded[0] = 0;
+        encoded[1] = 0;
+        return;
+    }
+    float x = direction[0] / length;
+    float y = direction[1] / length;
+    // The lower hemisphere is folded over the diagonals of the square.
+    if (direction[2] < 0.0f) {
+        float foldedX = (1.0f - std::abs(y)) * signNotZero(x);
+        float foldedY = (1.0f - std::abs(x)) * signNotZero(y);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = quantizeSnorm16(x);
+    encoded[1] = quantizeSnorm16(y);
+}
+
+void decodeOctahedral(const int16_t encoded[2], float direction[3]) {
+    float x = dequantizeSnorm16(encoded[0]);
+    float y = dequantizeSnorm16(encoded[1]);
+    float z = 1.0f - std::abs(x) - std::abs(y);
+    float t = std::max(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+
+    float length = std::sqrt(x * x + y * y + z * z);
+    direction[0] = x / length;
+    direction[1] = y / length;
+    direction[2] = z / length;
+}
+
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t floatExponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (floatExponent == 0xff) {
+        // Infinity stays infinity, NaN stays a quiet NaN.
+        return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    int32_t exponent = int32_t(floatExponent) - 127 + 15;
+    if (exponent >= 31) {
+        return uint16_t(sign | 0x7c00);
+    }
+    if (exponent <= 0) {
+        // Denormal, or zero when even the implicit bit is shifted out.
+        if (exponent < -10) {
+            return uint16_t(sign);
+        }
+        mantissa |= 0x800000;
+        uint32_t shift = uint32_t(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return uint16_t(sign | half);
+    }
+
+    // A carry out of the mantissa correctly bumps the exponent, up to infinity.
+    uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return uint16_t(sign | half);
+}
+
+float halfToFloat(uint16_t value) {
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    if (exponent == 0) {
+        float denormal = std::ldexp(float(mantissa), -24);
+        return sign ? -denormal : denormal;
+    }
+
+    uint32_t bits;
+    if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void getQuantizedVertexInput(uint32_t binding, VkVertexInputBindingDescription& bindingDescription,
+                             VkVertexInputAttributeDescription attributes[QUANTIZED_VERTEX_ATTRIBUTE_COUNT]) {
+    bindingDescription.binding = binding;
+    bindingDescription.stride = sizeof(QuantizedVertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    const VkFormat formats[QUANTIZED_VERTEX_ATTRIBUTE_COUNT] = {
+        VK_FORMAT_R16G16B16A16_UNORM,
+        VK_FORMAT_R16G16_SNORM,
+        VK_FORMAT_R16G16_SNORM,
+        VK_FORMAT_R16G16_SFLOAT,
+    };
+    const uint32_t offsets[QUANTIZED_VERTEX_ATTRIBUTE_COUNT] = {
+        uint32_t(offsetof(QuantizedVertex, position)),
+        uint32_t(offsetof(QuantizedVertex, normal)),
+        uint32_t(offsetof(QuantizedVertex, tangent)),
+        uint32_t(offsetof(QuantizedVertex, uv)),
+    };
+    for (uint32_t i = 0; i < QUANTIZED_VERTEX_ATTRIBUTE_COUNT; i++) {
+        attributes[i].location = i;
+        attributes[i].binding = binding;
+        attributes[i].format = formats[i];
+        attributes[i].offset = offsets[i];
+    }
+}
+
+const char* const QUANTIZED_VERTEX_GLSL =
+    "layout(location = 0) in vec4 inQuantizedPosition;\n"
+    "layout(location = 1) in vec2 inOctahedralNormal;\n"
+    "layout(location = 2) in vec2 inOctahedralTangent;\n"
+    "layout(location = 3) in vec2 inTexCoord;\n"
+    "\n"
+    "vec3 decodeOctahedral(vec2 e) {\n"
+    "    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+    "    float t = max(-v.z, 0.0);\n"
+    "    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);\n"
+    "    return normalize(v);\n"
+    "}\n"
+    "\n"
+    "// boundsMin and boundsScale are QuantizationBounds; not needed when the\n"
+    "// dequantization matrix is part of the world matrix.\n"
+    "vec3 decodePosition(vec3 boundsMin, vec3 boundsScale) {\n"
+    "    return boundsMin + inQuantizedPosition.xyz * boundsScale;\n"
+    "}\n"
+    "\n"
+    "vec3 decodeNormal() {\n"
+    "    return decodeOctahedral(inOctahedralNormal);\n"
+    "}\n"
+    "\n"
+    "// xyz is the tangent, w the bitangent sign.\n"
+    "vec4 decodeTangent() {\n"
+    "    return vec4(decodeOctahedral(inOctahedralTangent), inQuantizedPosition.w * 2.0 - 1.0);\n"
+    "}\n";
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    assert(indexCount % 3 == 0);
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles using each vertex; the first remainingTriangles[v] entries of
+    // a vertex's range are the ones not emitted yet.
+    std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++) {
+        assert(indices[i] < vertexCount);
+        remainingTriangles[indices[i]]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remainingTriangles[v];
+    }
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++) {
+        adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    std::vector<int32_t> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScore[v] = vertexCacheScore(-1, remainingTriangles[v]);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    size_t bestTriangle = 0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        const uint32_t* triangle = indices + t * 3;
+        triangleScore[t] = vertexScore[triangle[0]] + vertexScore[triangle[1]] + vertexScore[triangle[2]];
+        if (triangleScore[t] > triangleScore[bestTriangle]) {
+            bestTriangle = t;
+        }
+    }
+
+    std::vector<uint32_t> output;
+    output.reserve(indexCount);
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> newCache;
+    cache.reserve(VERTEX_CACHE_SIZE + 3);
+    newCache.reserve(VERTEX_CACHE_SIZE + 3);
+    size_t scanCursor = 0;
+
+    for (;;) {
+        const uint32_t* triangle = indices + bestTriangle * 3;
+        output.insert(output.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = 1;
+
+        // The emitted vertices move to the front of the cache.
+        newCache.assign(triangle, triangle + 3);
+        for (uint32_t vertex : cache) {
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+                newCache.push_back(vertex);
+            }
+        }
+
+        for (int corner = 0; corner < 3; corner++) {
+            uint32_t vertex = triangle[corner];
+            uint32_t* begin = adjacency.data() + adjacencyOffsets[vertex];
+            uint32_t* end = begin + remainingTriangles[vertex];
+            uint32_t* found = std::find(begin, end, uint32_t(bestTriangle));
+            if (found != end) {
+                std::swap(*found, *(end - 1));
+                remainingTriangles[vertex]--;
+            }
+        }
+
+        // Rescore every vertex whose cache position changed, including the
+        // ones that just fell out, and the triangles around them.
+        for (size_t i = 0; i < newCache.size(); i++) {
+            uint32_t vertex = newCache[i];
+            int32_t position = i < VERTEX_CACHE_SIZE ? int32_t(i) : -1;
+            cachePosition[vertex] = position;
+            float score = vertexCacheScore(position, remainingTriangles[vertex]);
+            float delta = score - vertexScore[vertex];
+            vertexScore[vertex] = score;
+
+            const uint32_t* begin = adjacency.data() + adjacencyOffsets[vertex];
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; j++) {
+                triangleScore[begin[j]] += delta;
+            }
+        }
+
+        // Only pick once every delta is in: a triangle with several cached
+        // vertices is updated once per vertex.
+        float bestScore = -1.0f;
+        bool foundBest = false;
+        for (uint32_t vertex : newCache) {
+            const uint32_t* begin = adjacency.data() + adjacencyOffsets[vertex];
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; j++) {
+                uint32_t t = begin[j];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                    foundBest = true;
+                }
+            }
+        }
+        if (newCache.size() > VERTEX_CACHE_SIZE) {
+            newCache.resize(VERTEX_CACHE_SIZE);
+        }
+        cache.swap(newCache);
+
+        if (output.size() == indexCount) {
+            break;
+        }
+        if (!foundBest) {
+            // Nothing left around the cache; continue with the next triangle
+            // in the original order.
+            while (emitted[scanCursor]) {
+                scanCursor++;
+            }
+            bestTriangle = scanCursor;
+        }
+    }
+
+    std::memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+size_t optimizeVertexFetch(void* vertices, size_t vertexSize, uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    uint32_t nextVertex = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t& target = remap[indices[i]];
+        if (target == UINT32_MAX) {
+            target = nextVertex++;
+        }
+        indices[i] = target;
+    }
+
+    uint8_t* bytes = static_cast<uint8_t*>(vertices);
+    std::vector<uint8_t> reordered(size_t(nextVertex) * vertexSize);
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (remap[v] != UINT32_MAX) {
+            std::memcpy(reordered.data() + remap[v] * vertexSize, bytes + v * vertexSize, vertexSize);
+        }
+    }
+    std::memcpy(bytes, reordered.data(), reordered.size());
+    return nextVertex;
+}
+
+float computeAverageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+    if (indexCount < 3) {
+        return 0.0f;
+    }
+    // A vertex is in the FIFO while fewer than cacheSize misses happened
+    // since it was loaded.
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = cacheSize + 1;
+    size_t firstMiss = misses;
+    for (size_t i = 0; i < indexCount; i++) {
+        size_t& loaded = loadedAt[indices[i]];
+        if (misses - loaded > cacheSize) {
+            loaded = misses++;
+        }
+    }
+    return float(misses - firstMiss) / float(indexCount / 3);
+}
+
+void benchmarkMesh(Renderer* renderer, uint32_t gridSize, uint32_t iterations) {
+    gridSize = std::max<uint32_t>(gridSize, 1);
+    iterations = std::max<uint32_t>(iterations, 1);
+
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+    buildBenchmarkGrid(gridSize, vertices, indices);
+
+    float shuffledRatio = computeAverageCacheMissRatio(indices.data(), indices.size(), vertices.size());
+    auto start = std::chrono::steady_clock::now();
+    optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+    double optimizeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    float optimizedRatio = computeAverageCacheMissRatio(indices.data(), indices.size(), vertices.size());
+    size_t vertexCount = optimizeVertexFetch(vertices.data(), sizeof(MeshVertex), indices.data(), indices.size(), vertices.size());
+    vertices.resize(vertexCount);
+
+    QuantizationBounds bounds = computeQuantizationBounds(vertices.data(), vertices.size());
+    std::vector<QuantizedVertex> quantized(vertices.size());
+    quantizeVertices(vertices.data(), vertices.size(), bounds, quantized.data());
+
+    VkDeviceSize fullBytes = vertices.size() * sizeof(MeshVertex);
+    VkDeviceSize quantizedBytes = quantized.size() * sizeof(QuantizedVertex);
+    printf("Mesh %ux%u grid: %lld vertices, %lld triangles\n", gridSize, gridSize,
+           (long long)vertices.size(), (long long)(indices.size() / 3));
+    printf("  ACMR            %5.3f shuffled, %5.3f after optimizeVertexCache (%.3f ms)\n",
+           shuffledRatio, optimizedRatio, optimizeMilliseconds);
+
+    VkDevice device = renderer->getDevice();
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = renderer->getGraphicsQueueFamilyIndex();
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    errorCheck(vkCreateCommandPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &commandPool));
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    errorCheck(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence = VK_NULL_HANDLE;
+    errorCheck(vkCreateFence(device, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &fence));
+
+    double fullMilliseconds = timeVertexUpload(renderer, commandBuffer, fence, vertices.data(), fullBytes, iterations);
+    double quantizedMilliseconds = timeVertexUpload(renderer, commandBuffer, fence, quantized.data(), quantizedBytes, iterations);
+    printf("  MeshVertex      %10lld bytes  upload %8.3f ms\n", (long long)fullBytes, fullMilliseconds);
+    printf("  QuantizedVertex %10lld bytes  upload %8.3f ms  (%.0f%% of the bytes, %.2fx faster)\n",
+           (long long)quantizedBytes, quantizedMilliseconds, 100.0 * double(quantizedBytes) / double(fullBytes),
+           quantizedMilliseconds > 0.0 ? fullMilliseconds / quantizedMilliseconds : 0.0);
+
+    vkDestroyFence(device, fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+    vkDestroyCommandPool(device, commandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstddef>
+#include <cstdint>
+
+class Renderer;
+
+// Full precision vertex as produced by mesh loaders, 48 bytes.
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+    // xyz is the tangent, w the bitangent sign (+1 or -1).
+    float tangent[4];
+    float uv[2];
+};
+
+// Compact vertex, 20 bytes:
+//   position  R16G16B16A16_UNORM  xyz relative to the mesh bounds, w is the
+//                                 bitangent sign (0 is -1, 1 is +1)
+//   normal    R16G16_SNORM        octahedral
+//   tangent   R16G16_SNORM        octahedral
+//   uv        R16G16_SFLOAT
+// The vertex fetch converts every attribute to floats; shaders only undo the
+// bounds and octahedral mappings, see QUANTIZED_VERTEX_GLSL.
+struct QuantizedVertex {
+    uint16_t position[4];
+    int16_t normal[2];
+    int16_t tangent[2];
+    uint16_t uv[2];
+};
+
+static_assert(sizeof(QuantizedVertex) == 20, "QuantizedVertex must match its vertex input description");
+
+// Object space position = min + unorm position * scale.
+struct QuantizationBounds {
+    float min[3];
+    float scale[3];
+};
+
+QuantizationBounds computeQuantizationBounds(const MeshVertex* vertices, size_t vertexCount);
+void quantizeVertices(const MeshVertex* vertices, size_t vertexCount, const QuantizationBounds& bounds, QuantizedVertex* quantized);
+// Reference decoder matching the shader code.
+void dequantizeVertex(const QuantizedVertex& quantized, const QuantizationBounds& bounds, MeshVertex& vertex);
+
+// Column-major matrix mapping the unorm position to object space. Multiplied
+// into the world matrix, it lets shaders skip decoding the position.
+void getDequantizationMatrix(const QuantizationBounds& bounds, float matrix[16]);
+
+// Unit vector to two snorm16 values in [-32767, 32767].
+void encodeOctahedral(const float direction[3], int16_t encoded[2]);
+void decodeOctahedral(const int16_t encoded[2], float direction[3]);
+
+// IEEE half precision, rounding to nearest even.
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+static const uint32_t QUANTIZED_VERTEX_ATTRIBUTE_COUNT = 4;
+
+// Vertex input state for a buffer of QuantizedVertex at the given binding,
+// using locations 0 to 3 in the order of the struct.
+void getQuantizedVertexInput(uint32_t binding, VkVertexInputBindingDescription& bindingDescription,
+                             VkVertexInputAttributeDescription attributes[QUANTIZED_VERTEX_ATTRIBUTE_COUNT]);
+
+// GLSL helpers for vertex shaders reading QuantizedVertex. Insert after the
+// #version line.
+extern const char* const QUANTIZED_VERTEX_GLSL;
+
+// Reorders triangles for the post-transform vertex cache (Forsyth's linear
+// speed optimizer). Every index must be below vertexCount.
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Reorders vertices in the order the indices first use them, so the vertex
+// fetch walks memory linearly, and rewrites the indices. Unreferenced vertices
+// are dropped. Works on any vertex layout; returns the new vertex count.
+size_t optimizeVertexFetch(void* vertices, size_t vertexSize, uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Average vertex shader invocations per triangle with a FIFO cache of
+// cacheSize entries; 0.5 is the best case for regular meshes, 3 the worst.
+float computeAverageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+
+// Builds a gridSize x gridSize height field with its triangles shuffled, as
+// loaders often emit them, and prints the vertex bytes of MeshVertex and
+// QuantizedVertex, the cache miss ratio before and after optimizeVertexCache,
+// and the time to upload each layout to device local memory.
+void benchmarkMesh(Renderer* renderer, uint32_t gridSize, uint32_t iterations);
@@ -0,0 +1,233 @@
+#include "stdafx.h"
+#include "MultiDevice.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "Shared.h"
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <stdio.h>
+#include <thread>
+
+uint32_t DeviceContext::findMemoryTypeIndex(uint32_t memoryTypeBits, VkMemoryPropertyFlags requiredFlags) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((memoryTypeBits & (1 << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & requiredFlags) == requiredFlags) {
+            return i;
+        }
+    }
+
+    assert(0 && "Couldn't find a suitable memory type");
+    std::exit(-1);
+}
+
+MultiDevice::MultiDevice(Renderer* renderer) {
+    mRenderer = renderer;
+
+    const std::vector<VkPhysicalDevice>& gpus = mRenderer->getPhysicalDevices();
+    mDevices.resize(gpus.size());
+    for (uint32_t i = 0; i < gpus.size(); i++) {
+        mDevices[i].index = i;
+        mDevices[i].physicalDevice = gpus[i];
+        initDevice(mDevices[i]);
+    }
+    mStatistics.resize(mDevices.size());
+
+    printf("Batch devices: %u\n", uint32_t(mDevices.size()));
+}
+
+MultiDevice::~MultiDevice() {
+    for (auto& device : mDevices) {
+        deinitDevice(device);
+    }
+}
+
+uint32_t MultiDevice::getDeviceCount() const {
+    return uint32_t(mDevices.size());
+}
+
+const DeviceContext& MultiDevice::getDevice(uint32_t index) const {
+    assert(index < mDevices.size());
+    return mDevices[index];
+}
+
+void MultiDevice::run(uint32_t jobCount, const std::function<void(DeviceContext&, uint32_t)>& job) {
+    std::atomic<uint32_t> nextJob{ 0 };
+    for (auto& statistics : mStatistics) {
+        statistics = DeviceWorkStatistics();
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(mDevices.size());
+    for (size_t i = 0; i < mDevices.size(); i++) {
+        threads.emplace_back([&, i] {
+            DeviceContext& device = mDevices[i];
+            DeviceWorkStatistics& statistics = mStatistics[i];
+            while (true) {
+                uint32_t jobIndex = nextJob++;
+                if (jobIndex >= jobCount) {
+                    break;
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                job(device, jobIndex);
+                auto end = std::chrono::high_resolution_clock::now();
+
+                statistics.jobsCompleted++;
+                statistics.busySeconds += std::chrono::duration<double>(end - start).count();
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+const std::vector<DeviceWorkStatistics>& MultiDevice::getStatistics() const {
+    return mStatistics;
+}
+
+void MultiDevice::initDevice(DeviceContext& context) {
+    vkGetPhysicalDeviceProperties(context.physicalDevice, &context.properties);
+    vkGetPhysicalDeviceMemoryProperties(context.physicalDevice, &context.memoryProperties);
+
+    uint32_t familyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(context.physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> familyProperties(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(context.physicalDevice, &familyCount, familyProperties.data());
+
+    // Prefer a graphics queue, fall back to compute only devices.
+    bool found = false;
+    for (uint32_t i = 0; i < familyCount && !found; i++) {
+        if (familyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+            context.queueFamilyIndex = i;
+            found = true;
+        }
+    }
+    for (uint32_t i = 0; i < familyCount && !found; i++) {
+        if (familyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
+            context.queueFamilyIndex = i;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        assert(0 && "Couldn't find a graphics or compute queue");
+        std::exit(-1);
+    }
+
+    float queuePriorities[]{ 1.0 };
+    VkDeviceQueueCreateInfo deviceQueueCreateInfo{};
+    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    deviceQueueCreateInfo.queueFamilyIndex = context.queueFamilyIndex;
+    deviceQueueCreateInfo.queueCount = 1;
+    deviceQueueCreateInfo.pQueuePriorities = queuePriorities;
+
+    // No swapchain extension: batch devices never present.
+    VkDeviceCreateInfo deviceCreateInfo{};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pQueueCreateInfos = &deviceQueueCreateInfo;
+
+    errorCheck(vkCreateDevice(context.physicalDevice, &deviceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_EXT), &context.device));
+    vkGetDeviceQueue(context.device, context.queueFamilyIndex, 0, &context.queue);
+
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = context.queueFamilyIndex;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    errorCheck(vkCreateCommandPool(context.device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &context.commandPool));
+}
+
+void MultiDevice::deinitDevice(DeviceContext& context) {
+    vkDeviceWaitIdle(context.device);
+    vkDestroyCommandPool(context.device, context.commandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+    vkDestroyDevice(context.device, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_EXT));
+    context.commandPool = VK_NULL_HANDLE;
+    context.device = VK_NULL_HANDLE;
+}
+
+void benchmarkMultiDevice(Renderer* renderer, uint32_t jobCount) {
+    // Large enough that the fill, not the submission, dominates a job.
+    const VkDeviceSize jobBufferSize = 16 * 1024 * 1024;
+    const uint32_t fillsPerJob = 16;
+
+    MultiDevice multiDevice(renderer);
+    jobCount = jobCount ? jobCount : 1;
+    printf("Batch: %u jobs, %u fills of %lld bytes each\n", jobCount, fillsPerJob, (long long)jobBufferSize);
+
+    auto start = std::chrono::steady_clock::now();
+    multiDevice.run(jobCount, [&](DeviceContext& context, uint32_t jobIndex) {
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = jobBufferSize;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        errorCheck(vkCreateBuffer(context.device, &bufferCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT), &buffer));
+
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(context.device, buffer, &requirements);
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = requirements.size;
+        memoryAllocateInfo.memoryTypeIndex = context.findMemoryTypeIndex(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        errorCheck(vkAllocateMemory(context.device, &memoryAllocateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_MEMORY_EXT), &memory));
+        errorCheck(vkBindBufferMemory(context.device, buffer, memory, 0));
+
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = context.commandPool;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        errorCheck(vkAllocateCommandBuffers(context.device, &commandBufferAllocateInfo, &commandBuffer));
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        errorCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        for (uint32_t i = 0; i < fillsPerJob; i++) {
+            // Fills of the same buffer must not overlap.
+            if (i > 0) {
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                     1, &barrier, 0, nullptr, 0, nullptr);
+            }
+            vkCmdFillBuffer(commandBuffer, buffer, 0, VK_WHOLE_SIZE, jobIndex + i);
+        }
+        errorCheck(vkEndCommandBuffer(commandBuffer));
+
+        VkFenceCreateInfo fenceCreateInfo{};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence = VK_NULL_HANDLE;
+        errorCheck(vkCreateFence(context.device, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &fence));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        errorCheck(vkQueueSubmit(context.queue, 1, &submitInfo, fence));
+        errorCheck(vkWaitForFences(context.device, 1, &fence, VK_TRUE, UINT64_MAX));
+
+        vkDestroyFence(context.device, fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+        vkFreeCommandBuffers(context.device, context.commandPool, 1, &commandBuffer);
+        vkDestroyBuffer(context.device, buffer, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT));
+        vkFreeMemory(context.device, memory, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_MEMORY_EXT));
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("  %.2f jobs/s (%.3f s)\n", seconds > 0.0 ? jobCount / seconds : 0.0, seconds);
+    const std::vector<DeviceWorkStatistics>& statistics = multiDevice.getStatistics();
+    for (uint32_t i = 0; i < multiDevice.getDeviceCount(); i++) {
+        printf("  device %u %-32s %6u jobs  %7.3f s busy\n", i, multiDevice.getDevice(i).properties.deviceName,
+               statistics[i].jobsCompleted, statistics[i].busySeconds);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <functional>
+#include <vector>
+
+class Renderer;
+
+// Logical device created on one of the enumerated physical devices.
+struct DeviceContext {
+    uint32_t index = 0;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex = 0;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties = {};
+    VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+    uint32_t findMemoryTypeIndex(uint32_t memoryTypeBits, VkMemoryPropertyFlags requiredFlags) const;
+};
+
+struct DeviceWorkStatistics {
+    uint32_t jobsCompleted = 0;
+    double busySeconds = 0.0;
+};
+
+// Offline batch mode: one logical device per physical device of the instance
+// (so two instances of a software driver count as two devices). Independent
+// jobs such as frames or tiles are pulled from a shared counter by one thread
+// per device, so faster devices naturally take more of the work.
+class MultiDevice {
+public:
+    // Uses the renderer's instance. Create the renderer with
+    // RendererMode::Headless to run on drivers without WSI support.
+    explicit MultiDevice(Renderer* renderer);
+    ~MultiDevice();
+
+    uint32_t getDeviceCount() const;
+    const DeviceContext& getDevice(uint32_t index) const;
+
+    // Runs job(device, jobIndex) for every jobIndex in [0, jobCount) and blocks
+    // until all of them are done. A job owns its device for its duration and is
+    // expected to wait for its own GPU work before returning.
+    void run(uint32_t jobCount, const std::function<void(DeviceContext&, uint32_t)>& job);
+
+    // Same as run(), gathering each job's host-side result by job index.
+    template <typename T>
+    std::vector<T> runAndGather(uint32_t jobCount, const std::function<T(DeviceContext&, uint32_t)>& job) {
+        // Each result gets its own object while the jobs run; std::vector<bool>
+        // packs elements into shared words that threads can't write concurrently.
+        struct Result {
+            T value;
+        };
+        std::vector<Result> results(jobCount);
+        run(jobCount, [&](DeviceContext& device, uint32_t jobIndex) {
+            results[jobIndex].value = job(device, jobIndex);
+        });
+
+        std::vector<T> values;
+        values.reserve(jobCount);
+        for (auto& result : results) {
+            values.push_back(std::move(result.value));
+        }
+        return values;
+    }
+
+    // Per device, for the last run().
+    const std::vector<DeviceWorkStatistics>& getStatistics() const;
+
+private:
+    void initDevice(DeviceContext& context);
+    void deinitDevice(DeviceContext& context);
+
+    Renderer* mRenderer = nullptr;
+    std::vector<DeviceContext> mDevices;
+    std::vector<DeviceWorkStatistics> mStatistics;
+};
+
+// Runs jobCount small GPU jobs (a buffer fill, submitted and waited on) across
+// every device and prints jobs per second and each device's share of the work.
+void benchmarkMultiDevice(Renderer* renderer, uint32_t jobCount);
@@ -1,44 +1,280 @@
 #include "stdafx.h"
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <assert.h>
 #include <stdio.h>
 #include <iostream>
 #include <sstream>
 #include "Renderer.h"
+#include "HostAllocator.h"
+#include "MemoryBudget.h"
+#include "BindlessTable.h"
+#include "CommandTrace.h"
+#include "ComputeDispatcher.h"
+#include "DeletionQueue.h"
+#include "FrameAllocator.h"
 #include "Shared.h"
 #include "BUILD_OPTIONS.h"
 #include "Platform.h"
 #include "Window.h"
 
-Renderer::Renderer() {
+Renderer::Renderer(RendererMode mode) {
+    mMode = mode;
     setupLayersAndExtensions();
     setupDebug();
     initInstance();
     initDebug();
     initDevice();
+    mMemoryBudget = new MemoryBudget(this, mMemoryBudgetExtensionEnabled);
+    mDeletionQueue = new DeletionQueue(this);
+    if (mBindlessEnabled) {
+        mBindlessTable = new BindlessTable(this);
+    }
+    initFrameResources();
+    mFrameUniforms = new FrameUniformAllocator(this, FRAME_UNIFORM_SIZE, MAX_FRAMES_IN_FLIGHT);
+    mComputeDispatcher = new ComputeDispatcher(this);
 }
 
 
 Renderer::~Renderer() {
-    delete mWindow;
+    stopRenderThread();
+    // The compute dispatcher waits on its own batch fences; after the frame
+    // fences nothing is left running on the device.
+    delete mComputeDispatcher;
+    mComputeDispatcher = nullptr;
+    waitForInFlightFrames();
+    for (auto window : mWindows) {
+        delete window;
+    }
+    mWindows.clear();
+    delete mBindlessTable;
+    mBindlessTable = nullptr;
+    // Its buffers go through the deletion queue.
+    delete mFrameUniforms;
+    mFrameUniforms = nullptr;
+    delete mDeletionQueue;
+    mDeletionQueue = nullptr;
+    deinitFrameResources();
+    delete mMemoryBudget;
+    mMemoryBudget = nullptr;
     deInitDevice();
     deinitDebug();
+#if BUILD_ENABLE_VULKAN_DEBUG
+    HostAllocator::printStatistics();
+#endif
     deInitInstance();
 }
 
 Window * Renderer::openWindow(uint32_t w, uint32_t h, std::string name) {
-    mWindow = new Window(this, w, h, name);
-    return mWindow;
+    if (isHeadless()) {
+        assert(0 && "Headless renderers can't open windows");
+        std::exit(-1);
+    }
+    // The render thread iterates mWindows, so it's paused while the list changes.
+    bool threaded = isRenderThreadRunning();
+    stopRenderThread();
+    Window* window = new Window(this, w, h, name);
+    mWindows.push_back(window);
+    if (threaded) {
+        startRenderThread();
+    }
+    return window;
 }
 
 bool Renderer::run() {
-    if (mWindow != nullptr) {
-        return mWindow->update();
+    if (mWindows.empty()) {
+        return true;
+    }
+
+    bool closedWindow = false;
+    for (auto window : mWindows) {
+        if (!window->update()) {
+            closedWindow = true;
+        }
+    }
+
+    if (closedWindow) {
+        // The render thread must not touch the windows we're about to destroy,
+        // and the GPU may still be presenting from their swapchains. Queued
+        // events may point at those windows too; the render thread delivers
+        // them before it exits, otherwise this thread is the rendering thread.
+        bool threaded = isRenderThreadRunning();
+        stopRenderThread();
+        if (!threaded) {
+            processInputEvents();
+        }
+        waitForInFlightFrames();
+        for (auto it = mWindows.begin(); it != mWindows.end();) {
+            if (!(*it)->isOpen()) {
+                delete *it;
+                it = mWindows.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (mWindows.empty()) {
+            return false;
+        }
+        if (threaded) {
+            startRenderThread();
+        }
     }
 
+    if (isRenderThreadRunning()) {
+        FramePacer::waitForMessages();
+    } else {
+        renderLoopIteration();
+    }
     return true;
 }
 
+void Renderer::startRenderThread() {
+    if (isRenderThreadRunning()) {
+        return;
+    }
+    mRenderThreadShouldRun = true;
+    mRenderThread = std::thread(&Renderer::renderThreadMain, this);
+}
+
+void Renderer::stopRenderThread() {
+    if (!isRenderThreadRunning()) {
+        return;
+    }
+    mRenderThreadShouldRun = false;
+    mFramePacer.wake();
+    mRenderThread.join();
+}
+
+bool Renderer::isRenderThreadRunning() const {
+    return mRenderThread.joinable();
+}
+
+void Renderer::renderThreadMain() {
+    while (mRenderThreadShouldRun) {
+        renderLoopIteration();
+    }
+    // Handlers only run on the rendering thread, so drain the queue here.
+    processInputEvents();
+}
+
+void Renderer::renderLoopIteration() {
+    processInputEvents();
+
+    if (!hasVisibleWindow() || (mRenderOnDemand && !consumeRedrawRequests())) {
+        mFramePacer.waitForEvents();
+        return;
+    }
+
+    if (!mFramePacer.isFrameDue()) {
+        mFramePacer.waitForFrameOrEvents();
+        return;
+    }
+
+    renderFrame();
+    recordInputLatency();
+    mFramePacer.frameRendered();
+}
+
+void Renderer::postInputEvent(const InputEvent& event) {
+    if (!mInputQueue.push(event)) {
+        mDroppedInputEvents++;
+    }
+    mFramePacer.wake();
+}
+
+void Renderer::setInputHandler(std::function<void(const InputEvent&)> handler) {
+    mInputHandler = handler;
+}
+
+void Renderer::setFrameRecordedHandler(std::function<void(Window&, VkCommandBuffer)> handler) {
+    mFrameRecordedHandler = handler;
+}
+
+Renderer::InputLatencyStatistics Renderer::getInputLatencyStatistics() const {
+    std::lock_guard<std::mutex> lock(mInputLatencyMutex);
+    InputLatencyStatistics statistics = mInputLatency;
+    statistics.droppedEvents = mDroppedInputEvents;
+    return statistics;
+}
+
+void Renderer::processInputEvents() {
+    InputEvent event;
+    while (mInputQueue.pop(event)) {
+        if (mOldestPendingInput == 0 || event.timestamp < mOldestPendingInput) {
+            mOldestPendingInput = event.timestamp;
+        }
+
+        if (event.type == InputEventType::Resize) {
+            VkExtent2D extent = event.window->getSurfaceExtent();
+            if (uint32_t(event.a) != extent.width || uint32_t(event.b) != extent.height) {
+                event.window->markSwapchainDirty();
+            }
+        }
+        if (event.type != InputEventType::Close) {
+            event.window->requestRedraw();
+        }
+
+        if (mInputHandler) {
+            mInputHandler(event);
+        }
+    }
+}
+
+void Renderer::recordInputLatency() {
+    if (mOldestPendingInput == 0) {
+        return;
+    }
+
+    double latency = double(inputTimestampNow() - mOldestPendingInput) / 1000000.0;
+    mOldestPendingInput = 0;
+
+    std::lock_guard<std::mutex> lock(mInputLatencyMutex);
+    mInputLatency.samples++;
+    mInputLatency.lastMilliseconds = latency;
+    mInputLatency.averageMilliseconds += (latency - mInputLatency.averageMilliseconds) / double(mInputLatency.samples);
+    if (latency > mInputLatency.maxMilliseconds) {
+        mInputLatency.maxMilliseconds = latency;
+    }
+}
+
+void Renderer::setTargetFrameRate(double framesPerSecond) {
+    mFramePacer.setTargetFrameRate(framesPerSecond);
+}
+
+void Renderer::setRenderOnDemand(bool renderOnDemand) {
+    mRenderOnDemand = renderOnDemand;
+    mRedrawRequested = true;
+}
+
+void Renderer::requestRedraw() {
+    mRedrawRequested = true;
+}
+
+bool Renderer::hasVisibleWindow() const {
+    for (auto window : mWindows) {
+        if (!window->isMinimized()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Renderer::consumeRedrawRequests() {
+    bool redraw = mRedrawRequested;
+    mRedrawRequested = false;
+    for (auto window : mWindows) {
+        if (window->consumeRedrawRequest()) {
+            redraw = true;
+        }
+    }
+    return redraw;
+}
+
+bool Renderer::isHeadless() const {
+    return mMode == RendererMode::Headless;
+}
+
 const VkInstance Renderer::getVulkanInstance() const {
     return mInstance;
 }
@@ -47,6 +283,10 @@ const VkPhysicalDevice Renderer::getPhysicalDevice() const {
     return mGpu;
 }
 
+const std::vector<VkPhysicalDevice>& Renderer::getPhysicalDevices() const {
+    return mGpus;
+}
+
 const VkDevice Renderer::getDevice() const {
     return mDevice;
 }
@@ -55,6 +295,25 @@ const VkQueue Renderer::getQueue() const {
     return mGraphicsQueue;
 }
 
+std::mutex& Renderer::getQueueMutex() const {
+    return mQueueMutex;
+}
+
+uint64_t Renderer::beginSubmit() {
+    return ++mSubmitSerial;
+}
+
+void Renderer::completeSubmit(uint64_t serial) {
+    uint64_t completed = mCompletedSubmitSerial.load();
+    while (completed < serial && !mCompletedSubmitSerial.compare_exchange_weak(completed, serial)) {
+    }
+    mDeletionQueue->collect(mCompletedSubmitSerial.load());
+}
+
+uint64_t Renderer::getSubmitSerial() const {
+    return mSubmitSerial;
+}
+
 const uint32_t Renderer::getGraphicsQueueFamilyIndex() const {
     return mGraphicsFamilyIndex;
 }
@@ -63,11 +322,88 @@ const VkPhysicalDeviceProperties & Renderer::getPhysicalDeviceProperties() const
     return mGpuProperties;
 }
 
+const VkPhysicalDeviceMemoryProperties & Renderer::getPhysicalDeviceMemoryProperties() const {
+    return mGpuMemoryProperties;
+}
+
+const std::vector<Window*>& Renderer::getWindows() const {
+    return mWindows;
+}
+
+uint32_t Renderer::getFrameSlot() const {
+    return mFrameSlot;
+}
+
+uint64_t Renderer::getFrameIndex() const {
+    return mFrameIndex;
+}
+
+uint64_t Renderer::getCompletedFrameCount() const {
+    return mCompletedFrameCount;
+}
+
+uint32_t Renderer::findMemoryTypeIndex(uint32_t memoryTypeBits, VkMemoryPropertyFlags requiredFlags) const {
+    for (uint32_t i = 0; i < mGpuMemoryProperties.memoryTypeCount; i++) {
+        if ((memoryTypeBits & (1 << i)) &&
+            (mGpuMemoryProperties.memoryTypes[i].propertyFlags & requiredFlags) == requiredFlags) {
+            return i;
+        }
+    }
+
+    assert(0 && "Couldn't find a suitable memory type");
+    std::exit(-1);
+}
+
+MemoryBudget& Renderer::getMemoryBudget() const {
+    return *mMemoryBudget;
+}
+
+ComputeDispatcher& Renderer::getComputeDispatcher() const {
+    return *mComputeDispatcher;
+}
+
+DeletionQueue& Renderer::getDeletionQueue() const {
+    return *mDeletionQueue;
+}
+
+BindlessTable* Renderer::getBindlessTable() const {
+    return mBindlessTable;
+}
+
+FrameArena& Renderer::getFrameArena() const {
+    return *mFrames[mFrameSlot].arena;
+}
+
+FrameUniformAllocator& Renderer::getFrameUniformAllocator() const {
+    return *mFrameUniforms;
+}
+
+const VulkanDispatch& Renderer::getDispatch() const {
+    return mDispatch;
+}
+
 void Renderer::setupLayersAndExtensions() {
-    mInstanceExtensionList.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
-    mInstanceExtensionList.push_back(PLATFORM_SURFACE_EXTENSION_NAME);
+    if (!isHeadless()) {
+        mInstanceExtensionList.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        mInstanceExtensionList.push_back(PLATFORM_SURFACE_EXTENSION_NAME);
 
-    mDeviceExtensionList.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        mDeviceExtensionList.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+
+#ifdef VK_KHR_get_physical_device_properties2
+    // Reading the memory budget and querying descriptor indexing support go
+    // through the *2KHR physical device queries.
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+    for (auto& extension : extensions) {
+        if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            mInstanceExtensionList.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            mProperties2ExtensionEnabled = true;
+        }
+    }
+#endif
 }
 
 void Renderer::initInstance() {
@@ -84,13 +420,14 @@ void Renderer::initInstance() {
     instanceCreateInfo.ppEnabledLayerNames = mInstanceLayerList.data();
     instanceCreateInfo.enabledExtensionCount = mInstanceExtensionList.size();
     instanceCreateInfo.ppEnabledExtensionNames = mInstanceExtensionList.data();
-    instanceCreateInfo.pNext = &mDebugCallbackCreateInfo;
+    instanceCreateInfo.pNext = mDebugReportEnabled ? &mDebugCallbackCreateInfo : nullptr;
 
-    errorCheck(vkCreateInstance(&instanceCreateInfo, nullptr, &mInstance));
+    errorCheck(vkCreateInstance(&instanceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_INSTANCE_EXT), &mInstance));
+    mDispatch.loadInstanceFunctions(mInstance);
 }
 
 void Renderer::deInitInstance() {
-    vkDestroyInstance(mInstance, nullptr);
+    vkDestroyInstance(mInstance, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_INSTANCE_EXT));
     mInstance = VK_NULL_HANDLE;
 }
 
@@ -98,25 +435,29 @@ void Renderer::initDevice() {
     uint32_t gpuCount;
     errorCheck(vkEnumeratePhysicalDevices(mInstance, &gpuCount, nullptr));
 
-    std::vector<VkPhysicalDevice> gpus(gpuCount);
-    errorCheck(vkEnumeratePhysicalDevices(mInstance, &gpuCount, gpus.data()));
+    mGpus.resize(gpuCount);
+    errorCheck(vkEnumeratePhysicalDevices(mInstance, &gpuCount, mGpus.data()));
 
     printf("GPUS:\n");
-    for (auto it = gpus.begin(); it < gpus.end(); it++) {
+    for (auto it = mGpus.begin(); it < mGpus.end(); it++) {
         checkDeviceProperties(*it);
     }
 
-    mGpu = gpus[0]; // Grabbing the first one (doesn't mean that the first one is the best one)
+    mGpu = mGpus[0]; // Grabbing the first one (doesn't mean that the first one is the best one)
     vkGetPhysicalDeviceProperties(mGpu, &mGpuProperties);
+    vkGetPhysicalDeviceMemoryProperties(mGpu, &mGpuMemoryProperties);
 
     uint32_t familyCount;
     vkGetPhysicalDeviceQueueFamilyProperties(mGpu, &familyCount, nullptr);
     std::vector<VkQueueFamilyProperties> familyProperties(familyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(mGpu, &familyCount, familyProperties.data());
 
+    // The compute dispatcher submits on this queue too, so the family must
+    // support both.
+    const VkQueueFlags requiredFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
     bool found = false;
     for (uint32_t i = 0; i < familyCount; i++) {
-        if (familyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if ((familyProperties[i].queueFlags & requiredFlags) == requiredFlags) {
             mGraphicsFamilyIndex = i;
             found = true;
             break;
@@ -124,7 +465,7 @@ void Renderer::initDevice() {
     }
 
     if (!found) {
-        assert(0 && "Couldn't find a graphics queue");
+        assert(0 && "Couldn't find a graphics and compute queue");
         std::exit(-1);
     }
 
@@ -150,6 +491,62 @@ void Renderer::initDevice() {
         }
     }*/
 
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(mGpu, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(mGpu, nullptr, &extensionCount, extensions.data());
+    auto hasDeviceExtension = [&extensions](const char* name) {
+        for (auto& extension : extensions) {
+            if (strcmp(extension.extensionName, name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+#ifdef VK_EXT_memory_budget
+    if (mProperties2ExtensionEnabled && hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+        mDeviceExtensionList.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        mMemoryBudgetExtensionEnabled = true;
+    }
+#endif
+
+    const void* deviceCreateNext = nullptr;
+#if BUILD_ENABLE_BINDLESS && defined(VK_EXT_descriptor_indexing)
+    // Only the features the bindless table relies on are enabled.
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+    descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if (mProperties2ExtensionEnabled && hasDeviceExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) &&
+        hasDeviceExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported{};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2KHR features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features.pNext = &supported;
+        mDispatch.vkGetPhysicalDeviceFeatures2KHR(mGpu, &features);
+
+        if (supported.runtimeDescriptorArray &&
+            supported.descriptorBindingPartiallyBound &&
+            supported.descriptorBindingStorageBufferUpdateAfterBind &&
+            supported.descriptorBindingSampledImageUpdateAfterBind &&
+            supported.descriptorBindingUpdateUnusedWhilePending &&
+            supported.shaderStorageBufferArrayNonUniformIndexing &&
+            supported.shaderSampledImageArrayNonUniformIndexing) {
+            descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+            descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+            descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+            descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+            descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+            descriptorIndexingFeatures.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+            descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            mDeviceExtensionList.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+            mDeviceExtensionList.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            deviceCreateNext = &descriptorIndexingFeatures;
+            mBindlessEnabled = true;
+        }
+    }
+#endif
+
     float queuePriorities[]{ 1.0 };
     VkDeviceQueueCreateInfo deviceQueueCreateInfo{};
     deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
@@ -159,6 +556,7 @@ void Renderer::initDevice() {
 
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pNext = deviceCreateNext;
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &deviceQueueCreateInfo;
     deviceCreateInfo.enabledLayerCount = mDeviceLayerList.size();
@@ -166,16 +564,201 @@ void Renderer::initDevice() {
     deviceCreateInfo.enabledExtensionCount = mDeviceExtensionList.size();
     deviceCreateInfo.ppEnabledExtensionNames = mDeviceExtensionList.data();
 
-    errorCheck(vkCreateDevice(mGpu, &deviceCreateInfo, nullptr, &mDevice));
-    vkGetDeviceQueue(mDevice, mGraphicsFamilyIndex, 0, &mGraphicsQueue);
+    errorCheck(vkCreateDevice(mGpu, &deviceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_EXT), &mDevice));
+    mDispatch.loadDeviceFunctions(mDevice);
+    mDispatch.vkGetDeviceQueue(mDevice, mGraphicsFamilyIndex, 0, &mGraphicsQueue);
 }
 
 void Renderer::deInitDevice() {
-    vkDeviceWaitIdle(mDevice);
-    vkDestroyDevice(mDevice, nullptr);
+    vkDestroyDevice(mDevice, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEVICE_EXT));
     mDevice = VK_NULL_HANDLE;
 }
 
+void Renderer::initFrameResources() {
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = mGraphicsFamilyIndex;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    errorCheck(vkCreateCommandPool(mDevice, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &mCommandPool));
+
+    for (auto& frame : mFrames) {
+        VkCommandBufferAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocateInfo.commandPool = mCommandPool;
+        allocateInfo.commandBufferCount = 1;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        errorCheck(vkAllocateCommandBuffers(mDevice, &allocateInfo, &frame.commandBuffer));
+
+        VkFenceCreateInfo fenceCreateInfo{};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        errorCheck(vkCreateFence(mDevice, &fenceCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT), &frame.fence));
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        errorCheck(vkCreateSemaphore(mDevice, &semaphoreCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT), &frame.renderFinished));
+
+        frame.arena = new FrameArena(FRAME_ARENA_SIZE);
+    }
+}
+
+void Renderer::waitForInFlightFrames() {
+    VkFence fences[MAX_FRAMES_IN_FLIGHT];
+    uint64_t submitSerial = 0;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        fences[i] = mFrames[i].fence;
+        submitSerial = std::max(submitSerial, mFrames[i].submitSerial);
+    }
+    errorCheck(vkWaitForFences(mDevice, MAX_FRAMES_IN_FLIGHT, fences, VK_TRUE, UINT64_MAX));
+    mCompletedFrameCount = mFrameIndex.load();
+    completeSubmit(submitSerial);
+}
+
+void Renderer::deinitFrameResources() {
+    for (auto& frame : mFrames) {
+        vkDestroySemaphore(mDevice, frame.renderFinished, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT));
+        vkDestroyFence(mDevice, frame.fence, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_FENCE_EXT));
+        delete frame.arena;
+        frame = FrameResources();
+    }
+    vkDestroyCommandPool(mDevice, mCommandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+    mCommandPool = VK_NULL_HANDLE;
+}
+
+void Renderer::renderFrame() {
+    FrameResources& frame = mFrames[mFrameSlot];
+    errorCheck(mDispatch.vkWaitForFences(mDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+    mCompletedFrameCount = std::max(mCompletedFrameCount.load(), frame.completedFrameCount);
+    completeSubmit(frame.submitSerial);
+    mMemoryBudget->update(mFrameIndex);
+    // The GPU is done with this slot, so its scratch memory can be reused.
+    frame.arena->reset();
+    mFrameUniforms->beginFrame(mFrameSlot);
+
+    // Old swapchains are handed to the deletion queue, so no device wait is needed.
+    for (auto window : mWindows) {
+        if (window->isSwapchainDirty()) {
+            window->recreateSwapChain();
+        }
+    }
+
+    // Per window arrays for the submit and present calls, from the frame arena.
+    uint32_t maxWindows = uint32_t(mWindows.size());
+    Window** windows = frame.arena->allocateArray<Window*>(maxWindows);
+    VkSemaphore* waitSemaphores = frame.arena->allocateArray<VkSemaphore>(maxWindows);
+    VkPipelineStageFlags* waitStages = frame.arena->allocateArray<VkPipelineStageFlags>(maxWindows);
+    VkSwapchainKHR* swapchains = frame.arena->allocateArray<VkSwapchainKHR>(maxWindows);
+    uint32_t* imageIndices = frame.arena->allocateArray<uint32_t>(maxWindows);
+    VkResult* results = frame.arena->allocateArray<VkResult>(maxWindows);
+    if (maxWindows > 0 && (windows == nullptr || waitSemaphores == nullptr || waitStages == nullptr ||
+                           swapchains == nullptr || imageIndices == nullptr || results == nullptr)) {
+        assert(0 && "Frame arena too small for the open windows");
+        std::exit(-1);
+    }
+
+    uint32_t windowCount = 0;
+    for (auto window : mWindows) {
+        if (!window->acquireNextImage(mFrameSlot)) {
+            continue;
+        }
+        windows[windowCount] = window;
+        waitSemaphores[windowCount] = window->getImageAvailableSemaphore(mFrameSlot);
+        waitStages[windowCount] = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        swapchains[windowCount] = window->getSwapchain();
+        imageIndices[windowCount] = window->getCurrentImageIndex();
+        results[windowCount] = VK_SUCCESS;
+        windowCount++;
+    }
+
+    if (windowCount == 0) {
+        // Everything is minimized or out of date; nothing to present this time.
+        return;
+    }
+
+    errorCheck(mDispatch.vkResetFences(mDevice, 1, &frame.fence));
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    errorCheck(mDispatch.vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+    for (uint32_t i = 0; i < windowCount; i++) {
+        windows[i]->recordFrame(frame.commandBuffer);
+        if (mFrameRecordedHandler) {
+            mFrameRecordedHandler(*windows[i], frame.commandBuffer);
+        }
+    }
+    errorCheck(mDispatch.vkEndCommandBuffer(frame.commandBuffer));
+    mFrameUniforms->endFrame();
+    writeFrameTrace(windows, windowCount);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = windowCount;
+    submitInfo.pWaitSemaphores = waitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &frame.renderFinished;
+    frame.completedFrameCount = mFrameIndex + 1;
+    std::unique_lock<std::mutex> queueLock(mQueueMutex);
+    frame.submitSerial = beginSubmit();
+    errorCheck(mDispatch.vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, frame.fence));
+
+    // One present call for every swapchain so the flips happen together.
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &frame.renderFinished;
+    presentInfo.swapchainCount = windowCount;
+    presentInfo.pSwapchains = swapchains;
+    presentInfo.pImageIndices = imageIndices;
+    presentInfo.pResults = results;
+    VkResult presentResult = mDispatch.vkQueuePresentKHR(mGraphicsQueue, &presentInfo);
+    queueLock.unlock();
+    if (presentResult != VK_ERROR_OUT_OF_DATE_KHR && presentResult != VK_SUBOPTIMAL_KHR) {
+        errorCheck(presentResult);
+    }
+
+    for (uint32_t i = 0; i < windowCount; i++) {
+        if (results[i] == VK_ERROR_OUT_OF_DATE_KHR || results[i] == VK_SUBOPTIMAL_KHR) {
+            windows[i]->markSwapchainDirty();
+        } else {
+            errorCheck(results[i]);
+        }
+    }
+
+    mFrameSlot = (mFrameSlot + 1) % MAX_FRAMES_IN_FLIGHT;
+    mFrameIndex++;
+}
+
+void Renderer::captureNextFrame(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mCaptureMutex);
+    mCapturePath = path;
+}
+
+void Renderer::writeFrameTrace(Window* const* windows, uint32_t windowCount) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mCaptureMutex);
+        if (mCapturePath.empty()) {
+            return;
+        }
+        path.swap(mCapturePath);
+    }
+
+    CommandTrace trace;
+    for (uint32_t i = 0; i < windowCount; i++) {
+        windows[i]->traceFrame(trace);
+    }
+    trace.endFrame();
+    if (trace.save(path)) {
+        printf("Captured frame %lld to %s (%lld bytes)\n", (long long)getFrameIndex(), path.c_str(), (long long)trace.getData().size());
+    } else {
+        printf("Failed to write frame capture %s\n", path.c_str());
+    }
+}
+
 #if BUILD_ENABLE_VULKAN_DEBUG
 
 VKAPI_ATTR VkBool32 VKAPI_CALL
@@ -219,6 +802,46 @@ VulkanDebugCallback(VkDebugReportFlagsEXT flags,
 }
 
 void Renderer::setupDebug() {
+    // The validation layer is optional so machines without the SDK, such as
+    // CI running a software driver, can still create the instance.
+    const char* validationLayer = "VK_LAYER_LUNARG_standard_validation";
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    std::vector<VkLayerProperties> layers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+    bool hasValidationLayer = false;
+    for (auto& layer : layers) {
+        if (strcmp(layer.layerName, validationLayer) == 0) {
+            hasValidationLayer = true;
+        }
+    }
+
+    bool hasDebugReport = false;
+    for (int source = 0; source < (hasValidationLayer ? 2 : 1); source++) {
+        const char* layerName = source == 0 ? nullptr : validationLayer;
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, extensions.data());
+        for (auto& extension : extensions) {
+            if (strcmp(extension.extensionName, VK_EXT_DEBUG_REPORT_EXTENSION_NAME) == 0) {
+                hasDebugReport = true;
+            }
+        }
+    }
+
+    if (hasValidationLayer) {
+        mInstanceLayerList.push_back(validationLayer);
+        mDeviceLayerList.push_back(validationLayer);
+    } else {
+        printf("%s is not installed, running without validation\n", validationLayer);
+    }
+    if (!hasDebugReport) {
+        return;
+    }
+
+    mDebugReportEnabled = true;
+    mInstanceExtensionList.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
     mDebugCallbackCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
     mDebugCallbackCreateInfo.pfnCallback = VulkanDebugCallback;
     mDebugCallbackCreateInfo.flags =
@@ -229,29 +852,25 @@ void Renderer::setupDebug() {
         //VK_DEBUG_REPORT_DEBUG_BIT_EXT |
         //VK_DEBUG_REPORT_FLAG_BITS_MAX_ENUM_EXT |
         0;
-
-    mInstanceLayerList.push_back("VK_LAYER_LUNARG_standard_validation");
-    mInstanceExtensionList.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-    mDeviceLayerList.push_back("VK_LAYER_LUNARG_standard_validation");
 }
 
-PFN_vkCreateDebugReportCallbackEXT fvkCreateDebugReportCallbackEXT = nullptr;
-PFN_vkDestroyDebugReportCallbackEXT fvkDestroyDebugReportCallbackEXT = nullptr;
-
 void Renderer::initDebug() {
-    fvkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(mInstance, "vkCreateDebugReportCallbackEXT");
-    fvkDestroyDebugReportCallbackEXT = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(mInstance, "vkDestroyDebugReportCallbackEXT");
-
-    if (fvkCreateDebugReportCallbackEXT == nullptr || fvkDestroyDebugReportCallbackEXT == nullptr) {
+    if (!mDebugReportEnabled) {
+        return;
+    }
+    if (mDispatch.vkCreateDebugReportCallbackEXT == nullptr || mDispatch.vkDestroyDebugReportCallbackEXT == nullptr) {
         assert(0 && "Error querying debug report functions");
         std::exit(-1);
     }
 
-    errorCheck(fvkCreateDebugReportCallbackEXT(mInstance, &mDebugCallbackCreateInfo, nullptr, &mDebugReport));
+    errorCheck(mDispatch.vkCreateDebugReportCallbackEXT(mInstance, &mDebugCallbackCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEBUG_REPORT_EXT), &mDebugReport));
 }
 
 void Renderer::deinitDebug() {
-    fvkDestroyDebugReportCallbackEXT(mInstance, mDebugReport, nullptr);
+    if (mDebugReport == VK_NULL_HANDLE) {
+        return;
+    }
+    mDispatch.vkDestroyDebugReportCallbackEXT(mInstance, mDebugReport, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_DEBUG_REPORT_EXT));
     mDebugReport = VK_NULL_HANDLE;
 }
 
@@ -1,25 +1,136 @@
 #pragma once
 
 #include "Platform.h"
+#include "FramePacer.h"
+#include "InputEvent.h"
+#include "SpscQueue.h"
+#include "VulkanDispatch.h"
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+class BindlessTable;
+class ComputeDispatcher;
+class DeletionQueue;
+class FrameArena;
+class FrameUniformAllocator;
+class MemoryBudget;
 class Window;
 
+enum class RendererMode {
+    Windowed,
+    // No surface or swapchain extensions, so the renderer also runs on drivers
+    // without WSI support (e.g. software drivers on CI machines). Windows
+    // can't be opened; batch, compute and replay work only.
+    Headless,
+};
+
 class Renderer {
 public:
-    Renderer();
+    static const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+    explicit Renderer(RendererMode mode = RendererMode::Windowed);
     ~Renderer();
 
+    // Every window gets its own surface and swapchain. All open windows are
+    // recorded into the same frame and presented with a single vkQueuePresentKHR.
+    // Main thread only; a running render thread is paused while the window is added.
     Window* openWindow(uint32_t w, uint32_t h, std::string name);
+    // Returns false once the last open window has been closed. Blocks on OS
+    // events while there's nothing to draw and paces frames when a target
+    // frame rate is set, so the main loop doesn't spin.
     bool run();
 
+    // Moves frame rendering to a dedicated thread. run() then only pumps OS
+    // messages on the calling thread and forwards input, resize and close
+    // events to the render thread through a lock-free queue. Configure pacing
+    // and handlers before starting it.
+    void startRenderThread();
+    void stopRenderThread();
+    bool isRenderThreadRunning() const;
+
+    void setTargetFrameRate(double framesPerSecond);
+    // When enabled, frames are only rendered after requestRedraw() or when a
+    // window reports input, resize or expose events.
+    void setRenderOnDemand(bool renderOnDemand);
+    void requestRedraw();
+
+    // Called by the OS message pump (main thread only).
+    void postInputEvent(const InputEvent& event);
+    // Invoked on the rendering thread for every event, before the frame is recorded.
+    void setInputHandler(std::function<void(const InputEvent&)> handler);
+    // Invoked on the rendering thread for every window once its commands are
+    // recorded into commandBuffer, before the frame is submitted and presented.
+    // The window's current image is in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR and
+    // must be left there; FrameCapture::record() reads it back from here.
+    void setFrameRecordedHandler(std::function<void(Window&, VkCommandBuffer)> handler);
+
+    struct InputLatencyStatistics {
+        uint64_t samples = 0;
+        uint64_t droppedEvents = 0;
+        double lastMilliseconds = 0.0;
+        double averageMilliseconds = 0.0;
+        double maxMilliseconds = 0.0;
+    };
+    // Time from the oldest event consumed by a frame to that frame's present call.
+    InputLatencyStatistics getInputLatencyStatistics() const;
+
+    bool isHeadless() const;
     const VkInstance getVulkanInstance() const;
     const VkPhysicalDevice getPhysicalDevice() const;
+    const std::vector<VkPhysicalDevice>& getPhysicalDevices() const;
     const VkDevice getDevice() const;
     const VkQueue getQueue() const;
+    // Held around every submit, present and device wait on getQueue(), which
+    // is shared by the render thread and the compute dispatcher.
+    std::mutex& getQueueMutex() const;
+    // Submits on getQueue() that are waited on with a fence take a serial from
+    // beginSubmit() while holding getQueueMutex(), and pass it to
+    // completeSubmit() once the fence has signaled. The queue finishes work in
+    // submission order, so every serial up to it is then complete and the
+    // DeletionQueue destroys what was retired before it, headless or not.
+    uint64_t beginSubmit();
+    void completeSubmit(uint64_t serial);
+    // Serial of the last submit that took one.
+    uint64_t getSubmitSerial() const;
     const uint32_t getGraphicsQueueFamilyIndex() const;
     const VkPhysicalDeviceProperties& getPhysicalDeviceProperties() const;
+    const VkPhysicalDeviceMemoryProperties& getPhysicalDeviceMemoryProperties() const;
+
+    uint32_t findMemoryTypeIndex(uint32_t memoryTypeBits, VkMemoryPropertyFlags requiredFlags) const;
+    // Per heap usage and budget, refreshed every frame. Device memory should be
+    // allocated through it so eviction handlers get a chance to make room.
+    MemoryBudget& getMemoryBudget() const;
+    // Batched compute jobs on the same device. Works without any open window.
+    ComputeDispatcher& getComputeDispatcher() const;
+    // Destroys retired objects once the submits that may still use them are done.
+    DeletionQueue& getDeletionQueue() const;
+    // Global descriptor table for bindless rendering, or nullptr when the
+    // device lacks descriptor indexing or BUILD_ENABLE_BINDLESS is off.
+    BindlessTable* getBindlessTable() const;
+    // Scratch memory of the frame being recorded, reset once the frame slot's
+    // fence has signaled. Render thread only, while recording.
+    FrameArena& getFrameArena() const;
+    // Per-draw uniform data of the frame being recorded, bound with dynamic
+    // offsets. Render thread only, while recording.
+    FrameUniformAllocator& getFrameUniformAllocator() const;
+    // Driver entry points for this instance and device. Use it on hot paths
+    // (recording, submission) to skip the loader trampolines.
+    const VulkanDispatch& getDispatch() const;
+
+    // Writes a CommandTrace of the next rendered frame to path. Safe from any
+    // thread; replay it with TraceReplayer or "--replay <path>".
+    void captureNextFrame(const std::string& path);
+
+    const std::vector<Window*>& getWindows() const;
+    uint32_t getFrameSlot() const;
+    uint64_t getFrameIndex() const;
+    // Frames whose GPU work is known to be complete.
+    uint64_t getCompletedFrameCount() const;
 
 private:
     void setupLayersAndExtensions();
@@ -33,22 +144,87 @@ private:
     void initDebug();
     void deinitDebug();
 
+    void initFrameResources();
+    void deinitFrameResources();
+    void waitForInFlightFrames();
+    void renderFrame();
+    void writeFrameTrace(Window* const* windows, uint32_t windowCount);
+    void renderLoopIteration();
+    void renderThreadMain();
+    void processInputEvents();
+    void recordInputLatency();
+    bool hasVisibleWindow() const;
+    bool consumeRedrawRequests();
+
     void checkDeviceProperties(VkPhysicalDevice gpu);
 
+    RendererMode mMode = RendererMode::Windowed;
     VkInstance mInstance = VK_NULL_HANDLE;
     VkPhysicalDevice mGpu = VK_NULL_HANDLE;
+    std::vector<VkPhysicalDevice> mGpus;
     VkDevice mDevice = VK_NULL_HANDLE;
     VkQueue mGraphicsQueue = VK_NULL_HANDLE;
     VkPhysicalDeviceProperties mGpuProperties = {};
+    VkPhysicalDeviceMemoryProperties mGpuMemoryProperties = {};
     uint32_t mGraphicsFamilyIndex = 0;
+    VulkanDispatch mDispatch;
+
+    MemoryBudget* mMemoryBudget = nullptr;
+    ComputeDispatcher* mComputeDispatcher = nullptr;
+    DeletionQueue* mDeletionQueue = nullptr;
+    BindlessTable* mBindlessTable = nullptr;
+    mutable std::mutex mQueueMutex;
+    bool mProperties2ExtensionEnabled = false;
+    bool mMemoryBudgetExtensionEnabled = false;
+    bool mBindlessEnabled = false;
+
+    struct FrameResources {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkSemaphore renderFinished = VK_NULL_HANDLE;
+        // Frames known to be complete once the fence signals.
+        uint64_t completedFrameCount = 0;
+        uint64_t submitSerial = 0;
+        FrameArena* arena = nullptr;
+    };
+
+    static const size_t FRAME_ARENA_SIZE = 256 * 1024;
+    static const VkDeviceSize FRAME_UNIFORM_SIZE = 4 * 1024 * 1024;
+
+    std::vector<Window*> mWindows;
+
+    std::string mCapturePath;
+    std::mutex mCaptureMutex;
+
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    FrameResources mFrames[MAX_FRAMES_IN_FLIGHT];
+    FrameUniformAllocator* mFrameUniforms = nullptr;
+    uint32_t mFrameSlot = 0;
+    std::atomic<uint64_t> mFrameIndex{ 0 };
+    std::atomic<uint64_t> mCompletedFrameCount{ 0 };
+    std::atomic<uint64_t> mSubmitSerial{ 0 };
+    std::atomic<uint64_t> mCompletedSubmitSerial{ 0 };
+
+    FramePacer mFramePacer;
+    bool mRenderOnDemand = false;
+    std::atomic<bool> mRedrawRequested{ true };
 
-    Window* mWindow = nullptr;
+    std::thread mRenderThread;
+    std::atomic<bool> mRenderThreadShouldRun{ false };
+    SpscQueue<InputEvent, 1024> mInputQueue;
+    std::function<void(const InputEvent&)> mInputHandler;
+    std::function<void(Window&, VkCommandBuffer)> mFrameRecordedHandler;
+    uint64_t mOldestPendingInput = 0;
+    InputLatencyStatistics mInputLatency;
+    mutable std::mutex mInputLatencyMutex;
+    std::atomic<uint64_t> mDroppedInputEvents{ 0 };
 
     std::vector<const char*> mInstanceLayerList;
     std::vector<const char*> mInstanceExtensionList;
     std::vector<const char*> mDeviceLayerList;
     std::vector<const char*> mDeviceExtensionList;
 
+    bool mDebugReportEnabled = false;
     VkDebugReportCallbackEXT mDebugReport = VK_NULL_HANDLE;
     VkDebugReportCallbackCreateInfoEXT mDebugCallbackCreateInfo = {};
 };
@@ -14,6 +14,17 @@ std::wstring s2ws(const std::string& s) {
     return r;
 }
 
+std::string ws2s(const std::wstring& s) {
+    int len;
+    int slength = (int)s.length() + 1;
+    len = WideCharToMultiByte(CP_ACP, 0, s.c_str(), slength, 0, 0, 0, 0);
+    char* buf = new char[len];
+    WideCharToMultiByte(CP_ACP, 0, s.c_str(), slength, buf, len, 0, 0);
+    std::string r(buf);
+    delete[] buf;
+    return r;
+}
+
 #endif
 
 #if BUILD_ENABLE_VULKAN_RUNTIME_DEBUG
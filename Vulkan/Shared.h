@@ -6,6 +6,7 @@
 
 #ifdef _WIN32
 std::wstring s2ws(const std::string& s);
+std::string ws2s(const std::wstring& s);
 #endif
 
 void errorCheck(VkResult result);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side. Returns false when the queue is full.
+    bool push(const T& value) {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        mItems[head & (Capacity - 1)] = value;
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when the queue is empty.
+    bool pop(T& value) {
+        size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mHead.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = mItems[tail & (Capacity - 1)];
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return mTail.load(std::memory_order_acquire) == mHead.load(std::memory_order_acquire);
+    }
+
+private:
+    T mItems[Capacity];
+    // Padded apart so producer and consumer don't false share a cache line.
+    // (Padding instead of alignas keeps the owner heap allocatable pre C++17.)
+    char mPadding0[64];
+    std::atomic<size_t> mHead{ 0 };
+    char mPadding1[64];
+    std::atomic<size_t> mTail{ 0 };
+};
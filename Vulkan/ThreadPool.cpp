@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Pool whose work the current thread is running, if any. Nested parallelFor()
+// calls on that pool run inline since every thread is already busy with the
+// outer call.
+thread_local const ThreadPool* tActivePool = nullptr;
+
+}
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    mWorkers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++) {
+        mWorkers.emplace_back(&ThreadPool::workerMain, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShouldRun = false;
+    }
+    mWakeCondition.notify_all();
+    for (auto& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& func) {
+    if (count == 0) {
+        return;
+    }
+
+    minBatch = std::max<size_t>(minBatch, 1);
+    size_t threadCount = mWorkers.size() + 1;
+    if (mWorkers.empty() || count <= minBatch || tActivePool == this) {
+        func(0, count);
+        return;
+    }
+
+    // One parallelFor at a time; concurrent callers from other threads
+    // serialize here.
+    std::lock_guard<std::mutex> callLock(mCallMutex);
+    const ThreadPool* previousPool = tActivePool;
+    tActivePool = this;
+
+    // A few chunks per thread keeps the load balanced without much contention.
+    size_t chunkSize = std::max(minBatch, (count + threadCount * 4 - 1) / (threadCount * 4));
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFunc = &func;
+        mCount = count;
+        mChunkSize = chunkSize;
+        mNextChunk = 0;
+        mActiveWorkers = uint32_t(mWorkers.size());
+        mGeneration++;
+    }
+    mWakeCondition.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCondition.wait(lock, [this] { return mActiveWorkers == 0; });
+    mFunc = nullptr;
+    tActivePool = previousPool;
+}
+
+uint32_t ThreadPool::getWorkerCount() const {
+    return uint32_t(mWorkers.size());
+}
+
+ThreadPool& ThreadPool::getShared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::workerMain() {
+    tActivePool = this;
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeCondition.wait(lock, [&] { return !mShouldRun || mGeneration != seenGeneration; });
+            if (!mShouldRun) {
+                return;
+            }
+            seenGeneration = mGeneration;
+        }
+
+        runChunks();
+
+        if (--mActiveWorkers == 0) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runChunks() {
+    while (true) {
+        size_t begin = mNextChunk.fetch_add(mChunkSize);
+        if (begin >= mCount) {
+            break;
+        }
+        (*mFunc)(begin, std::min(begin + mChunkSize, mCount));
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads used to split data-parallel CPU work (culling,
+// transform updates, ...) across cores. The calling thread takes part in the
+// work, so parallelFor() returns once every range has been processed.
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t workerCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Calls func(begin, end) over [0, count) in chunks of at least minBatch
+    // elements. Runs inline when the range is too small to be worth splitting,
+    // and when called from inside func (nested calls don't deadlock).
+    void parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)>& func);
+
+    uint32_t getWorkerCount() const;
+
+    static ThreadPool& getShared();
+
+private:
+    void workerMain();
+    void runChunks();
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWakeCondition;
+    std::condition_variable mDoneCondition;
+    bool mShouldRun = true;
+    uint64_t mGeneration = 0;
+
+    const std::function<void(size_t, size_t)>* mFunc = nullptr;
+    size_t mCount = 0;
+    size_t mChunkSize = 0;
+    std::atomic<size_t> mNextChunk{ 0 };
+    std::atomic<uint32_t> mActiveWorkers{ 0 };
+    std::mutex mCallMutex;
+};
@@ -0,0 +1,296 @@
+#include "stdafx.h"
+#include "Transforms.h"
+#include "MappedBuffer.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
+#include <numeric>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define TRANSFORMS_HAS_SSE 1
+#include <xmmintrin.h>
+#endif
+
+static const uint32_t NO_PARENT = UINT32_MAX;
+
+namespace {
+
+void composeLocal(float out[16], float px, float py, float pz,
+                  float qx, float qy, float qz, float qw,
+                  float sx, float sy, float sz) {
+    float xx = qx * qx, yy = qy * qy, zz = qz * qz;
+    float xy = qx * qy, xz = qx * qz, yz = qy * qz;
+    float wx = qw * qx, wy = qw * qy, wz = qw * qz;
+
+    out[0] = (1.0f - 2.0f * (yy + zz)) * sx;
+    out[1] = (2.0f * (xy + wz)) * sx;
+    out[2] = (2.0f * (xz - wy)) * sx;
+    out[3] = 0.0f;
+
+    out[4] = (2.0f * (xy - wz)) * sy;
+    out[5] = (1.0f - 2.0f * (xx + zz)) * sy;
+    out[6] = (2.0f * (yz + wx)) * sy;
+    out[7] = 0.0f;
+
+    out[8] = (2.0f * (xz + wy)) * sz;
+    out[9] = (2.0f * (yz - wx)) * sz;
+    out[10] = (1.0f - 2.0f * (xx + yy)) * sz;
+    out[11] = 0.0f;
+
+    out[12] = px;
+    out[13] = py;
+    out[14] = pz;
+    out[15] = 1.0f;
+}
+
+// out = a * b, all column-major. out must not alias a or b.
+void multiply(float* out, const float* a, const float* b) {
+#if TRANSFORMS_HAS_SSE
+    __m128 c0 = _mm_load_ps(a + 0);
+    __m128 c1 = _mm_load_ps(a + 4);
+    __m128 c2 = _mm_load_ps(a + 8);
+    __m128 c3 = _mm_load_ps(a + 12);
+    for (int col = 0; col < 4; col++) {
+        const float* bc = b + col * 4;
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(bc[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(bc[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(bc[2])));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(bc[3])));
+        _mm_store_ps(out + col * 4, r);
+    }
+#else
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) {
+            out[col * 4 + row] = a[0 + row] * b[col * 4 + 0] +
+                                 a[4 + row] * b[col * 4 + 1] +
+                                 a[8 + row] * b[col * 4 + 2] +
+                                 a[12 + row] * b[col * 4 + 3];
+        }
+    }
+#endif
+}
+
+template <typename T>
+void permute(T& values, const std::vector<uint32_t>& order) {
+    T sorted(values.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        sorted[i] = values[order[i]];
+    }
+    values.swap(sorted);
+}
+
+} // namespace
+
+TransformHierarchy::TransformHierarchy(uint32_t frameSlotCount) {
+    mFrameSlotCount = std::max<uint32_t>(frameSlotCount, 1);
+}
+
+TransformId TransformHierarchy::add(TransformId parent) {
+    TransformId id = TransformId(mHandleToIndex.size());
+    uint32_t index = uint32_t(mHandle.size());
+
+    uint32_t parentIndex = NO_PARENT;
+    uint32_t depth = 0;
+    if (parent != INVALID_TRANSFORM) {
+        assert(parent < mHandleToIndex.size());
+        parentIndex = mHandleToIndex[parent];
+        depth = mDepth[parentIndex] + 1;
+    }
+
+    mHandleToIndex.push_back(index);
+    mHandle.push_back(id);
+    mParent.push_back(parentIndex);
+    mDepth.push_back(depth);
+    mPositionX.push_back(0.0f);
+    mPositionY.push_back(0.0f);
+    mPositionZ.push_back(0.0f);
+    mRotationX.push_back(0.0f);
+    mRotationY.push_back(0.0f);
+    mRotationZ.push_back(0.0f);
+    mRotationW.push_back(1.0f);
+    mScaleX.push_back(1.0f);
+    mScaleY.push_back(1.0f);
+    mScaleZ.push_back(1.0f);
+    mDirty.push_back(1);
+    mPendingUploads.push_back(0);
+    mWorld.resize(mWorld.size() + 16, 0.0f);
+
+    // Depth order and level ranges are rebuilt lazily on the next update.
+    mOrderDirty = true;
+    return id;
+}
+
+void TransformHierarchy::setLocal(TransformId id, const float position[3], const float rotation[4], const float scale[3]) {
+    assert(id < mHandleToIndex.size());
+    uint32_t index = mHandleToIndex[id];
+    mPositionX[index] = position[0];
+    mPositionY[index] = position[1];
+    mPositionZ[index] = position[2];
+    mRotationX[index] = rotation[0];
+    mRotationY[index] = rotation[1];
+    mRotationZ[index] = rotation[2];
+    mRotationW[index] = rotation[3];
+    mScaleX[index] = scale[0];
+    mScaleY[index] = scale[1];
+    mScaleZ[index] = scale[2];
+    mDirty[index] = 1;
+}
+
+void TransformHierarchy::setPosition(TransformId id, const float position[3]) {
+    assert(id < mHandleToIndex.size());
+    uint32_t index = mHandleToIndex[id];
+    mPositionX[index] = position[0];
+    mPositionY[index] = position[1];
+    mPositionZ[index] = position[2];
+    mDirty[index] = 1;
+}
+
+void TransformHierarchy::update(ThreadPool* pool, float* mappedMatrices) {
+    if (mOrderDirty) {
+        rebuildOrder();
+    }
+
+    // Levels are processed in order; every node of a level only reads its
+    // parent, which belongs to an earlier level, so a level can be split freely.
+    for (size_t level = 0; level + 1 < mLevelOffsets.size(); level++) {
+        size_t begin = mLevelOffsets[level];
+        size_t end = mLevelOffsets[level + 1];
+        if (pool != nullptr && end - begin >= mParallelThreshold) {
+            pool->parallelFor(end - begin, mParallelThreshold / 4, [&](size_t chunkBegin, size_t chunkEnd) {
+                updateRange(begin + chunkBegin, begin + chunkEnd, mappedMatrices);
+            });
+        } else {
+            updateRange(begin, end, mappedMatrices);
+        }
+    }
+
+    std::fill(mDirty.begin(), mDirty.end(), uint8_t(0));
+}
+
+const float* TransformHierarchy::getWorldMatrix(TransformId id) const {
+    assert(id < mHandleToIndex.size());
+    return &mWorld[size_t(mHandleToIndex[id]) * 16];
+}
+
+size_t TransformHierarchy::size() const {
+    return mHandle.size();
+}
+
+void TransformHierarchy::setParallelThreshold(size_t nodeCount) {
+    mParallelThreshold = std::max<size_t>(nodeCount, 4);
+}
+
+void TransformHierarchy::updateRange(size_t begin, size_t end, float* mappedMatrices) {
+    alignas(16) float local[16];
+    for (size_t i = begin; i < end; i++) {
+        uint32_t parent = mParent[i];
+        if (parent != NO_PARENT && mDirty[parent]) {
+            mDirty[i] = 1;
+        }
+
+        float* world = &mWorld[i * 16];
+        if (mDirty[i]) {
+            if (parent == NO_PARENT) {
+                composeLocal(world, mPositionX[i], mPositionY[i], mPositionZ[i],
+                             mRotationX[i], mRotationY[i], mRotationZ[i], mRotationW[i],
+                             mScaleX[i], mScaleY[i], mScaleZ[i]);
+            } else {
+                composeLocal(local, mPositionX[i], mPositionY[i], mPositionZ[i],
+                             mRotationX[i], mRotationY[i], mRotationZ[i], mRotationW[i],
+                             mScaleX[i], mScaleY[i], mScaleZ[i]);
+                multiply(world, &mWorld[size_t(parent) * 16], local);
+            }
+            mPendingUploads[i] = uint8_t(mFrameSlotCount);
+        }
+
+        if (mappedMatrices != nullptr && mPendingUploads[i] > 0) {
+            std::memcpy(mappedMatrices + size_t(mHandle[i]) * 16, world, sizeof(float) * 16);
+            mPendingUploads[i]--;
+        }
+    }
+}
+
+void TransformHierarchy::rebuildOrder() {
+    size_t count = mHandle.size();
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return mDepth[a] < mDepth[b];
+    });
+
+    std::vector<uint32_t> oldToNew(count);
+    for (size_t i = 0; i < count; i++) {
+        oldToNew[order[i]] = uint32_t(i);
+    }
+
+    permute(mHandle, order);
+    permute(mParent, order);
+    permute(mDepth, order);
+    permute(mPositionX, order);
+    permute(mPositionY, order);
+    permute(mPositionZ, order);
+    permute(mRotationX, order);
+    permute(mRotationY, order);
+    permute(mRotationZ, order);
+    permute(mRotationW, order);
+    permute(mScaleX, order);
+    permute(mScaleY, order);
+    permute(mScaleZ, order);
+    permute(mDirty, order);
+    permute(mPendingUploads, order);
+
+    AlignedVector<float> world(mWorld.size());
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(&world[i * 16], &mWorld[size_t(order[i]) * 16], sizeof(float) * 16);
+    }
+    mWorld.swap(world);
+
+    for (size_t i = 0; i < count; i++) {
+        if (mParent[i] != NO_PARENT) {
+            mParent[i] = oldToNew[mParent[i]];
+        }
+        mHandleToIndex[mHandle[i]] = uint32_t(i);
+    }
+
+    mLevelOffsets.clear();
+    for (size_t i = 0; i < count; i++) {
+        while (mLevelOffsets.size() <= mDepth[i]) {
+            mLevelOffsets.push_back(uint32_t(i));
+        }
+    }
+    mLevelOffsets.push_back(uint32_t(count));
+
+    mOrderDirty = false;
+}
+
+TransformBuffer::TransformBuffer(Renderer* renderer, uint32_t maxTransforms, uint32_t frameSlotCount) {
+    mMaxTransforms = maxTransforms;
+    for (uint32_t i = 0; i < frameSlotCount; i++) {
+        mBuffers.emplace_back(new MappedBuffer(renderer, VkDeviceSize(maxTransforms) * sizeof(float) * 16,
+                                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT));
+    }
+}
+
+TransformBuffer::~TransformBuffer() {
+}
+
+void TransformBuffer::update(TransformHierarchy& hierarchy, uint32_t frameSlot, ThreadPool* pool) {
+    assert(frameSlot < mBuffers.size());
+    assert(hierarchy.size() <= mMaxTransforms);
+
+    MappedBuffer* buffer = mBuffers[frameSlot].get();
+    hierarchy.update(pool, static_cast<float*>(buffer->getMappedData()));
+    buffer->flush();
+}
+
+MappedBuffer* TransformBuffer::getBuffer(uint32_t frameSlot) const {
+    assert(frameSlot < mBuffers.size());
+    return mBuffers[frameSlot].get();
+}
+
+uint32_t TransformBuffer::getMaxTransforms() const {
+    return mMaxTransforms;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class MappedBuffer;
+class Renderer;
+class ThreadPool;
+
+typedef uint32_t TransformId;
+static const TransformId INVALID_TRANSFORM = UINT32_MAX;
+
+// Local transforms of the scene kept as structure-of-arrays, ordered by depth
+// in the hierarchy so world matrices can be resolved one level at a time
+// without chasing parent pointers. Only dirty nodes and their descendants
+// are recomputed.
+class TransformHierarchy {
+public:
+    // frameSlotCount is the number of per-frame output buffers a changed
+    // matrix has to be written into before it stops being uploaded.
+    explicit TransformHierarchy(uint32_t frameSlotCount = 1);
+
+    TransformId add(TransformId parent = INVALID_TRANSFORM);
+    void setLocal(TransformId id, const float position[3], const float rotation[4], const float scale[3]);
+    void setPosition(TransformId id, const float position[3]);
+
+    // Recomputes dirty world matrices breadth first. When mappedMatrices is not
+    // null, matrices that changed within the last frameSlotCount updates are
+    // also written to mappedMatrices[id * 16].
+    void update(ThreadPool* pool = nullptr, float* mappedMatrices = nullptr);
+
+    // Column-major 4x4 world matrix, valid after update().
+    const float* getWorldMatrix(TransformId id) const;
+    size_t size() const;
+
+    void setParallelThreshold(size_t nodeCount);
+
+private:
+    void rebuildOrder();
+    void updateRange(size_t begin, size_t end, float* mappedMatrices);
+
+    uint32_t mFrameSlotCount = 1;
+    size_t mParallelThreshold = 4096;
+    bool mOrderDirty = false;
+
+    std::vector<uint32_t> mHandleToIndex;
+    std::vector<uint32_t> mLevelOffsets;
+
+    // Indexed by depth-sorted position.
+    std::vector<TransformId> mHandle;
+    std::vector<uint32_t> mParent;
+    std::vector<uint32_t> mDepth;
+    AlignedVector<float> mPositionX;
+    AlignedVector<float> mPositionY;
+    AlignedVector<float> mPositionZ;
+    AlignedVector<float> mRotationX;
+    AlignedVector<float> mRotationY;
+    AlignedVector<float> mRotationZ;
+    AlignedVector<float> mRotationW;
+    AlignedVector<float> mScaleX;
+    AlignedVector<float> mScaleY;
+    AlignedVector<float> mScaleZ;
+    std::vector<uint8_t> mDirty;
+    std::vector<uint8_t> mPendingUploads;
+    AlignedVector<float> mWorld;
+};
+
+// One persistently mapped storage buffer of world matrices per frame slot,
+// indexed by TransformId in the shaders.
+class TransformBuffer {
+public:
+    TransformBuffer(Renderer* renderer, uint32_t maxTransforms, uint32_t frameSlotCount);
+    ~TransformBuffer();
+
+    void update(TransformHierarchy& hierarchy, uint32_t frameSlot, ThreadPool* pool = nullptr);
+
+    MappedBuffer* getBuffer(uint32_t frameSlot) const;
+    uint32_t getMaxTransforms() const;
+
+private:
+    std::vector<std::unique_ptr<MappedBuffer>> mBuffers;
+    uint32_t mMaxTransforms = 0;
+};
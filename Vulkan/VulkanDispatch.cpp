@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#include "VulkanDispatch.h"
+#include "Renderer.h"
+#include "HostAllocator.h"
+#include "Shared.h"
+
+#include <chrono>
+#include <stdio.h>
+
+void benchmarkDispatch(Renderer* renderer, uint32_t callCount, uint32_t iterations) {
+    VkDevice device = renderer->getDevice();
+    const VulkanDispatch& dispatch = renderer->getDispatch();
+
+    VkCommandPoolCreateInfo poolCreateInfo{};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = renderer->getGraphicsQueueFamilyIndex();
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    errorCheck(vkCreateCommandPool(device, &poolCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT), &commandPool));
+
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    errorCheck(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+
+    VkViewport viewport{};
+    viewport.width = 800.0f;
+    viewport.height = 600.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    callCount = callCount ? callCount : 1;
+    iterations = iterations ? iterations : 1;
+    printf("Dispatch: %u vkCmdSetViewport calls, %u iterations\n", callCount, iterations);
+
+    double loaderNanoseconds = 0.0;
+    for (uint32_t run = 0; run < 2; run++) {
+        // The first run goes through the loader trampolines, the second through the table.
+        PFN_vkCmdSetViewport setViewport = run == 0 ? ::vkCmdSetViewport : dispatch.vkCmdSetViewport;
+        double seconds = 0.0;
+        // One extra untimed pass warms up the command buffer's memory.
+        for (uint32_t i = 0; i <= iterations; i++) {
+            errorCheck(dispatch.vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t call = 0; call < callCount; call++) {
+                setViewport(commandBuffer, 0, 1, &viewport);
+            }
+            auto end = std::chrono::steady_clock::now();
+            errorCheck(dispatch.vkEndCommandBuffer(commandBuffer));
+            if (i > 0) {
+                seconds += std::chrono::duration<double>(end - start).count();
+            }
+        }
+
+        double nanoseconds = seconds * 1e9 / (double(callCount) * iterations);
+        if (run == 0) {
+            loaderNanoseconds = nanoseconds;
+        }
+        printf("  %-7s %7.2f ns/call  %5.2fx\n", run == 0 ? "loader" : "table",
+               nanoseconds, nanoseconds > 0.0 ? loaderNanoseconds / nanoseconds : 0.0);
+    }
+
+    vkDestroyCommandPool(device, commandPool, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_COMMAND_POOL_EXT));
+}
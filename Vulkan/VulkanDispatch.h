@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <cstdint>
+
+class Renderer;
+
+#ifdef VK_KHR_get_physical_device_properties2
+#define VULKAN_PROPERTIES2_FUNCTIONS(X) \
+    X(vkGetPhysicalDeviceFeatures2KHR) \
+    X(vkGetPhysicalDeviceProperties2KHR) \
+    X(vkGetPhysicalDeviceMemoryProperties2KHR)
+#else
+#define VULKAN_PROPERTIES2_FUNCTIONS(X)
+#endif
+
+// Every Vulkan entry point the engine calls after instance creation. Adding a
+// name here adds the table member and its loading code.
+#define VULKAN_INSTANCE_FUNCTIONS(X) \
+    X(vkDestroyInstance) \
+    X(vkEnumeratePhysicalDevices) \
+    X(vkGetPhysicalDeviceFeatures) \
+    X(vkGetPhysicalDeviceProperties) \
+    X(vkGetPhysicalDeviceMemoryProperties) \
+    X(vkGetPhysicalDeviceQueueFamilyProperties) \
+    X(vkEnumerateDeviceExtensionProperties) \
+    X(vkEnumerateDeviceLayerProperties) \
+    X(vkCreateDevice) \
+    X(vkGetDeviceProcAddr) \
+    X(vkDestroySurfaceKHR) \
+    X(vkGetPhysicalDeviceSurfaceSupportKHR) \
+    X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR) \
+    X(vkGetPhysicalDeviceSurfaceFormatsKHR) \
+    X(vkGetPhysicalDeviceSurfacePresentModesKHR) \
+    X(vkCreateDebugReportCallbackEXT) \
+    X(vkDestroyDebugReportCallbackEXT) \
+    VULKAN_PROPERTIES2_FUNCTIONS(X)
+
+#define VULKAN_DEVICE_FUNCTIONS(X) \
+    X(vkDestroyDevice) \
+    X(vkGetDeviceQueue) \
+    X(vkDeviceWaitIdle) \
+    X(vkQueueSubmit) \
+    X(vkQueueWaitIdle) \
+    X(vkCreateFence) \
+    X(vkDestroyFence) \
+    X(vkResetFences) \
+    X(vkGetFenceStatus) \
+    X(vkWaitForFences) \
+    X(vkCreateSemaphore) \
+    X(vkDestroySemaphore) \
+    X(vkAllocateMemory) \
+    X(vkFreeMemory) \
+    X(vkMapMemory) \
+    X(vkUnmapMemory) \
+    X(vkFlushMappedMemoryRanges) \
+    X(vkInvalidateMappedMemoryRanges) \
+    X(vkCreateBuffer) \
+    X(vkDestroyBuffer) \
+    X(vkGetBufferMemoryRequirements) \
+    X(vkBindBufferMemory) \
+    X(vkCreateImage) \
+    X(vkDestroyImage) \
+    X(vkDestroyImageView) \
+    X(vkGetImageMemoryRequirements) \
+    X(vkBindImageMemory) \
+    X(vkCreateShaderModule) \
+    X(vkDestroyShaderModule) \
+    X(vkCreateComputePipelines) \
+    X(vkDestroyPipeline) \
+    X(vkCreatePipelineLayout) \
+    X(vkDestroyPipelineLayout) \
+    X(vkCreateDescriptorSetLayout) \
+    X(vkDestroyDescriptorSetLayout) \
+    X(vkCreateDescriptorPool) \
+    X(vkDestroyDescriptorPool) \
+    X(vkResetDescriptorPool) \
+    X(vkAllocateDescriptorSets) \
+    X(vkUpdateDescriptorSets) \
+    X(vkCreateQueryPool) \
+    X(vkDestroyQueryPool) \
+    X(vkGetQueryPoolResults) \
+    X(vkCreateCommandPool) \
+    X(vkDestroyCommandPool) \
+    X(vkAllocateCommandBuffers) \
+    X(vkFreeCommandBuffers) \
+    X(vkBeginCommandBuffer) \
+    X(vkEndCommandBuffer) \
+    X(vkCmdExecuteCommands) \
+    X(vkCmdBindPipeline) \
+    X(vkCmdBindDescriptorSets) \
+    X(vkCmdBindVertexBuffers) \
+    X(vkCmdBindIndexBuffer) \
+    X(vkCmdSetViewport) \
+    X(vkCmdSetScissor) \
+    X(vkCmdPushConstants) \
+    X(vkCmdDraw) \
+    X(vkCmdDrawIndexed) \
+    X(vkCmdDispatch) \
+    X(vkCmdCopyBuffer) \
+    X(vkCmdCopyImageToBuffer) \
+    X(vkCmdClearColorImage) \
+    X(vkCmdPipelineBarrier) \
+    X(vkCmdResetQueryPool) \
+    X(vkCmdWriteTimestamp) \
+    X(vkCreateSwapchainKHR) \
+    X(vkDestroySwapchainKHR) \
+    X(vkGetSwapchainImagesKHR) \
+    X(vkAcquireNextImageKHR) \
+    X(vkQueuePresentKHR)
+
+// Function pointers fetched straight from the driver. Device functions come
+// from vkGetDeviceProcAddr, so calls through the table skip the loader's
+// trampoline and dispatch lookup. Pointers of extensions that weren't enabled
+// stay null. A device table is only valid for the device it was loaded from.
+struct VulkanDispatch {
+#define VULKAN_DISPATCH_MEMBER(name) PFN_##name name = nullptr;
+    VULKAN_INSTANCE_FUNCTIONS(VULKAN_DISPATCH_MEMBER)
+    VULKAN_DEVICE_FUNCTIONS(VULKAN_DISPATCH_MEMBER)
+#undef VULKAN_DISPATCH_MEMBER
+
+    void loadInstanceFunctions(VkInstance instance) {
+#define VULKAN_LOAD_INSTANCE_FUNCTION(name) name = (PFN_##name)::vkGetInstanceProcAddr(instance, #name);
+        VULKAN_INSTANCE_FUNCTIONS(VULKAN_LOAD_INSTANCE_FUNCTION)
+#undef VULKAN_LOAD_INSTANCE_FUNCTION
+    }
+
+    // loadInstanceFunctions() must have been called first.
+    void loadDeviceFunctions(VkDevice device) {
+#define VULKAN_LOAD_DEVICE_FUNCTION(name) name = (PFN_##name)vkGetDeviceProcAddr(device, #name);
+        VULKAN_DEVICE_FUNCTIONS(VULKAN_LOAD_DEVICE_FUNCTION)
+#undef VULKAN_LOAD_DEVICE_FUNCTION
+    }
+};
+
+// Records callCount vkCmdSetViewport calls into one command buffer, first
+// through the loader exports and then through the renderer's table, and
+// prints the average cost per call of each. Works on a headless renderer.
+void benchmarkDispatch(Renderer* renderer, uint32_t callCount, uint32_t iterations);
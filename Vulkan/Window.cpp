@@ -1,5 +1,9 @@
 #include "stdafx.h"
 #include "Window.h"
+#include "CommandCache.h"
+#include "CommandTrace.h"
+#include "DeletionQueue.h"
+#include "HostAllocator.h"
 #include "Shared.h"
 #include "Renderer.h"
 
@@ -9,13 +13,18 @@ Window::Window(Renderer* renderer, uint32_t sizeX, uint32_t sizeY, std::string n
     mRenderer = renderer;
     mSurfaceSizeX = sizeX;
     mSurfaceSizeY = sizeY;
+    mName = name;
     mWindowName = s2ws(name);
     initOSWindow();
     initSurface();
     initSwapChain();
+    initSyncObjects();
+    mCommandCache = new CommandCache(mRenderer);
 }
 
 Window::~Window() {
+    delete mCommandCache;
+    deinitSyncObjects();
     deinitSwapChain();
     deinitOSWindow();
     deinitSurface();
@@ -30,6 +39,190 @@ bool Window::update() {
     return mWindowShouldRun;
 }
 
+bool Window::isOpen() const {
+    return mWindowShouldRun;
+}
+
+void Window::postEvent(InputEventType type, int32_t a, int32_t b, int32_t x, int32_t y) {
+    InputEvent event;
+    event.type = type;
+    event.window = this;
+    event.a = a;
+    event.b = b;
+    event.x = x;
+    event.y = y;
+    event.timestamp = inputTimestampNow();
+    mRenderer->postInputEvent(event);
+}
+
+void Window::requestRedraw() {
+    mRedrawRequested = true;
+}
+
+bool Window::consumeRedrawRequest() {
+    bool requested = mRedrawRequested;
+    mRedrawRequested = false;
+    return requested;
+}
+
+bool Window::acquireNextImage(uint32_t frameSlot) {
+    if (mSwapchain == VK_NULL_HANDLE || mSwapchainDirty) {
+        return false;
+    }
+
+    VkResult result = mRenderer->getDispatch().vkAcquireNextImageKHR(mRenderer->getDevice(), mSwapchain, UINT64_MAX,
+                                                                     mImageAvailableSemaphores[frameSlot], VK_NULL_HANDLE, &mCurrentImageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        mSwapchainDirty = true;
+        return false;
+    }
+    if (result == VK_SUBOPTIMAL_KHR) {
+        // The semaphore is signaled, so the image still has to be presented.
+        mSwapchainDirty = true;
+        return true;
+    }
+
+    errorCheck(result);
+    return true;
+}
+
+void Window::recordFrame(VkCommandBuffer commandBuffer) {
+    VkImage image = getCurrentImage();
+
+    CommandDependencies dependencies;
+    dependencies.addSwapchain(mSwapchain);
+    dependencies.addImage(image);
+    dependencies.addValue(&mClearColor, sizeof(mClearColor));
+
+    VkCommandBuffer clearCommands = mCommandCache->getCommandBuffer(mCurrentImageIndex, dependencies, [this, image](VkCommandBuffer cachedCommandBuffer) {
+        recordClear(cachedCommandBuffer, image);
+    });
+    mRenderer->getDispatch().vkCmdExecuteCommands(commandBuffer, 1, &clearCommands);
+}
+
+void Window::recordClear(VkCommandBuffer commandBuffer, VkImage image) const {
+    const VulkanDispatch& dispatch = mRenderer->getDispatch();
+
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+
+    VkImageMemoryBarrier toTransfer{};
+    toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toTransfer.srcAccessMask = 0;
+    toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange = range;
+    dispatch.vkCmdPipelineBarrier(commandBuffer,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  0,
+                                  0, nullptr,
+                                  0, nullptr,
+                                  1, &toTransfer);
+
+    dispatch.vkCmdClearColorImage(commandBuffer, toTransfer.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &mClearColor, 1, &range);
+
+    VkImageMemoryBarrier toPresent = toTransfer;
+    toPresent.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toPresent.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    dispatch.vkCmdPipelineBarrier(commandBuffer,
+                                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                  0,
+                                  0, nullptr,
+                                  0, nullptr,
+                                  1, &toPresent);
+}
+
+void Window::traceFrame(CommandTrace& trace) const {
+    VkExtent2D extent = getSurfaceExtent();
+    uint32_t image = trace.createImage(extent.width, extent.height, getSurfaceFormat(), VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    trace.beginPass(mName);
+    trace.clearImage(image, mClearColor.float32);
+    trace.endPass();
+}
+
+void Window::markSwapchainDirty() {
+    mSwapchainDirty = true;
+}
+
+bool Window::isSwapchainDirty() const {
+    return mSwapchainDirty;
+}
+
+void Window::recreateSwapChain() {
+    VkPhysicalDevice gpu = mRenderer->getPhysicalDevice();
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu, mSurface, &mSurfaceCapabilities);
+    if (mSurfaceCapabilities.currentExtent.width < UINT32_MAX) {
+        mSurfaceSizeX = mSurfaceCapabilities.currentExtent.width;
+        mSurfaceSizeY = mSurfaceCapabilities.currentExtent.height;
+    }
+
+    mSwapchainDirty = false;
+
+    // The old swapchain may still be in use by frames in flight, so it goes
+    // through the deletion queue instead of being destroyed here.
+    VkSwapchainKHR oldSwapchain = mSwapchain;
+
+    // A minimized window has a zero sized surface; retry once it comes back.
+    if (mSurfaceSizeX == 0 || mSurfaceSizeY == 0) {
+        mSwapchain = VK_NULL_HANDLE;
+        mSwapchainImages.clear();
+        mSwapchainDirty = true;
+    } else {
+        // Passed as oldSwapchain so the presentation engine can hand over its resources.
+        initSwapChain();
+    }
+
+    if (oldSwapchain != VK_NULL_HANDLE) {
+        mRenderer->getDeletionQueue().retireSwapchain(oldSwapchain);
+    }
+    // Cached commands reference the old images.
+    mCommandCache->clear();
+}
+
+void Window::setClearColor(float r, float g, float b, float a) {
+    mClearColor.float32[0] = r;
+    mClearColor.float32[1] = g;
+    mClearColor.float32[2] = b;
+    mClearColor.float32[3] = a;
+}
+
+VkSwapchainKHR Window::getSwapchain() const {
+    return mSwapchain;
+}
+
+VkSemaphore Window::getImageAvailableSemaphore(uint32_t frameSlot) const {
+    return mImageAvailableSemaphores[frameSlot];
+}
+
+uint32_t Window::getCurrentImageIndex() const {
+    return mCurrentImageIndex;
+}
+
+VkImage Window::getCurrentImage() const {
+    return mSwapchainImages[mCurrentImageIndex];
+}
+
+VkFormat Window::getSurfaceFormat() const {
+    return mSurfaceFormat.format;
+}
+
+VkExtent2D Window::getSurfaceExtent() const {
+    VkExtent2D extent;
+    extent.width = mSurfaceSizeX;
+    extent.height = mSurfaceSizeY;
+    return extent;
+}
+
 void Window::initSurface() {
     initOSSurface();
 
@@ -65,7 +258,7 @@ void Window::initSurface() {
 }
 
 void Window::deinitSurface() {
-    vkDestroySurfaceKHR(mRenderer->getVulkanInstance(), mSurface, nullptr);
+    vkDestroySurfaceKHR(mRenderer->getVulkanInstance(), mSurface, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SURFACE_KHR_EXT));
 }
 
 void Window::initSwapChain() {
@@ -92,7 +285,11 @@ void Window::initSwapChain() {
     createInfo.imageExtent.width = mSurfaceSizeX;
     createInfo.imageExtent.height = mSurfaceSizeY;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    // Allows FrameCapture::record() to read the presented images back.
+    if (mSurfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) {
+        createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
     createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
     createInfo.queueFamilyIndexCount = 0;
     createInfo.pQueueFamilyIndices = nullptr;
@@ -100,13 +297,33 @@ void Window::initSwapChain() {
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    createInfo.oldSwapchain = mSwapchain;
 
-    errorCheck(vkCreateSwapchainKHR(mRenderer->getDevice(), &createInfo, nullptr, &mSwapchain));
+    errorCheck(vkCreateSwapchainKHR(mRenderer->getDevice(), &createInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SWAPCHAIN_KHR_EXT), &mSwapchain));
 
     errorCheck(vkGetSwapchainImagesKHR(mRenderer->getDevice(), mSwapchain, &mSwapchainImageCount, nullptr));
+    mSwapchainImages.resize(mSwapchainImageCount);
+    errorCheck(vkGetSwapchainImagesKHR(mRenderer->getDevice(), mSwapchain, &mSwapchainImageCount, mSwapchainImages.data()));
 }
 
 void Window::deinitSwapChain() {
-    vkDestroySwapchainKHR(mRenderer->getDevice(), mSwapchain, nullptr);
+    vkDestroySwapchainKHR(mRenderer->getDevice(), mSwapchain, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SWAPCHAIN_KHR_EXT));
+    mSwapchain = VK_NULL_HANDLE;
+    mSwapchainImages.clear();
+}
+
+void Window::initSyncObjects() {
+    mImageAvailableSemaphores.resize(Renderer::MAX_FRAMES_IN_FLIGHT);
+    for (auto& semaphore : mImageAvailableSemaphores) {
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        errorCheck(vkCreateSemaphore(mRenderer->getDevice(), &semaphoreCreateInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT), &semaphore));
+    }
+}
+
+void Window::deinitSyncObjects() {
+    for (auto semaphore : mImageAvailableSemaphores) {
+        vkDestroySemaphore(mRenderer->getDevice(), semaphore, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SEMAPHORE_EXT));
+    }
+    mImageAvailableSemaphores.clear();
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "Platform.h"
+#include "InputEvent.h"
 #include <string>
+#include <vector>
 
+class CommandCache;
+class CommandTrace;
 class Renderer;
 
 class Window {
@@ -12,6 +16,42 @@ public:
 
     void close();
     bool update();
+    bool isOpen() const;
+    bool isMinimized() const;
+
+    // Timestamps an OS event and forwards it to the renderer's input queue.
+    void postEvent(InputEventType type, int32_t a = 0, int32_t b = 0, int32_t x = 0, int32_t y = 0);
+
+    // Set by input, resize and expose events; read by on-demand rendering.
+    // Only touched by the thread that renders.
+    void requestRedraw();
+    bool consumeRedrawRequest();
+
+    // Acquires the next swapchain image, signaling the image available semaphore
+    // of frameSlot. Returns false when there's nothing to render into (minimized
+    // or out of date swapchain).
+    bool acquireNextImage(uint32_t frameSlot);
+    // Records the commands drawing into the acquired image and leaves it ready
+    // to present. They are cached per swapchain image and only re-recorded
+    // when the swapchain or clear color changes.
+    void recordFrame(VkCommandBuffer commandBuffer);
+    // Appends what recordFrame() does to a command trace, in a pass named after the window.
+    void traceFrame(CommandTrace& trace) const;
+
+    void markSwapchainDirty();
+    bool isSwapchainDirty() const;
+    // Caller makes sure the GPU no longer uses the old swapchain.
+    void recreateSwapChain();
+
+    void setClearColor(float r, float g, float b, float a);
+
+    VkSwapchainKHR getSwapchain() const;
+    VkSemaphore getImageAvailableSemaphore(uint32_t frameSlot) const;
+    uint32_t getCurrentImageIndex() const;
+    VkImage getCurrentImage() const;
+    VkFormat getSurfaceFormat() const;
+    VkExtent2D getSurfaceExtent() const;
+
 private:
     void initOSWindow();
     void deinitOSWindow();
@@ -21,11 +61,21 @@ private:
     void deinitSurface();
     void initSwapChain();
     void deinitSwapChain();
+    void initSyncObjects();
+    void deinitSyncObjects();
+    void recordClear(VkCommandBuffer commandBuffer, VkImage image) const;
 
     Renderer* mRenderer = nullptr;
+    std::string mName;
 
     VkSurfaceKHR mSurface = VK_NULL_HANDLE;
     VkSwapchainKHR mSwapchain = VK_NULL_HANDLE;
+    std::vector<VkImage> mSwapchainImages;
+    std::vector<VkSemaphore> mImageAvailableSemaphores;
+    uint32_t mCurrentImageIndex = 0;
+    bool mSwapchainDirty = false;
+    VkClearColorValue mClearColor = {};
+    CommandCache* mCommandCache = nullptr;
 
     uint32_t mSurfaceSizeX = 512;
     uint32_t mSurfaceSizeY = 512;
@@ -34,6 +84,7 @@ private:
     VkSurfaceFormatKHR mSurfaceFormat = {};
     VkSurfaceCapabilitiesKHR mSurfaceCapabilities = {};
     bool mWindowShouldRun = true;
+    bool mRedrawRequested = true;
 
 #if VK_USE_PLATFORM_WIN32_KHR
     std::wstring mWindowName;
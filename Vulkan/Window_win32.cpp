@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "BUILD_OPTIONS.h"
 #include "Platform.h"
+#include "HostAllocator.h"
 #include "Window.h"
 #include "Renderer.h"
 #include <assert.h>
@@ -10,12 +11,51 @@
 LRESULT CALLBACK WindowsEventHandler(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
     Window* window = (Window*)GetWindowLongPtrW(hWnd, GWLP_USERDATA);
 
+    // Messages arriving while CreateWindowEx runs come before the user data is set.
+    if (window == nullptr) {
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    int32_t x = int16_t(LOWORD(lParam));
+    int32_t y = int16_t(HIWORD(lParam));
+
     switch (uMsg) {
     case WM_CLOSE:
         window->close();
+        window->postEvent(InputEventType::Close);
         return 0;
     case WM_SIZE:
-        // Recreate swap chain, blabla
+        window->postEvent(InputEventType::Resize, LOWORD(lParam), HIWORD(lParam));
+        break;
+    case WM_PAINT:
+        window->postEvent(InputEventType::Expose);
+        break;
+    case WM_KEYDOWN:
+        window->postEvent(InputEventType::KeyDown, int32_t(wParam));
+        break;
+    case WM_KEYUP:
+        window->postEvent(InputEventType::KeyUp, int32_t(wParam));
+        break;
+    case WM_CHAR:
+        window->postEvent(InputEventType::Char, int32_t(wParam));
+        break;
+    case WM_MOUSEMOVE:
+        window->postEvent(InputEventType::MouseMove, 0, 0, x, y);
+        break;
+    case WM_LBUTTONDOWN:
+        window->postEvent(InputEventType::MouseButtonDown, 0, 0, x, y);
+        break;
+    case WM_LBUTTONUP:
+        window->postEvent(InputEventType::MouseButtonUp, 0, 0, x, y);
+        break;
+    case WM_RBUTTONDOWN:
+        window->postEvent(InputEventType::MouseButtonDown, 1, 0, x, y);
+        break;
+    case WM_RBUTTONUP:
+        window->postEvent(InputEventType::MouseButtonUp, 1, 0, x, y);
+        break;
+    case WM_MOUSEWHEEL:
+        window->postEvent(InputEventType::MouseWheel, 0, GET_WHEEL_DELTA_WPARAM(wParam), x, y);
         break;
     default:
         break;
@@ -91,19 +131,24 @@ void Window::deinitOSWindow() {
 }
 
 void Window::updateOSWindow() {
+    // Drain everything that is pending so input doesn't queue up behind frames.
     MSG msg;
-    if (PeekMessage(&msg, mWin32Window, 0, 0, PM_REMOVE)) {
+    while (PeekMessage(&msg, mWin32Window, 0, 0, PM_REMOVE)) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
 }
 
+bool Window::isMinimized() const {
+    return IsIconic(mWin32Window) != FALSE;
+}
+
 void Window::initOSSurface() {
     VkWin32SurfaceCreateInfoKHR createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
     createInfo.hinstance = mWin32Instance;
     createInfo.hwnd = mWin32Window;
-    vkCreateWin32SurfaceKHR(mRenderer->getVulkanInstance(), &createInfo, nullptr, &mSurface);
+    vkCreateWin32SurfaceKHR(mRenderer->getVulkanInstance(), &createInfo, HostAllocator::getCallbacks(VK_DEBUG_REPORT_OBJECT_TYPE_SURFACE_KHR_EXT), &mSurface);
 }
 
 #endif
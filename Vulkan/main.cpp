@@ -3,12 +3,20 @@
 
 #include "stdafx.h"
 #include "resource.h"
+#include "CommandTrace.h"
+#include "Culling.h"
+#include "MeshQuantization.h"
+#include "MultiDevice.h"
 #include "Renderer.h"
 #include "Shared.h"
+#include "ThreadPool.h"
+#include "VulkanDispatch.h"
 #include <process.h>
 #include <iostream>
 #include <io.h>
 #include <fcntl.h>
+#include <shellapi.h>
+#include <string>
 
 #define MAX_LOADSTRING 100
 
@@ -34,7 +42,90 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_ LPWSTR    lpCmdLine,
                       _In_ int       nCmdShow) {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    // "--replay <trace> [iterations]" replays a captured frame headless and
+    // prints per pass timings instead of opening a window.
+    int argumentCount = 0;
+    LPWSTR* arguments = CommandLineToArgvW(lpCmdLine, &argumentCount);
+    if (arguments && argumentCount >= 2 && wcscmp(arguments[0], L"--replay") == 0) {
+        CreateConsole();
+        std::string path = ws2s(arguments[1]);
+        uint32_t iterations = argumentCount >= 3 ? uint32_t(_wtoi(arguments[2])) : 100;
+        LocalFree(arguments);
+
+        CommandTrace trace;
+        int exitCode = -1;
+        if (trace.load(path)) {
+            // No surface or swapchain: replays run on drivers and machines without WSI.
+            Renderer* renderer = new Renderer(RendererMode::Headless);
+            {
+                TraceReplayer replayer(renderer);
+                if (replayer.replay(trace, iterations)) {
+                    replayer.printReport();
+                    exitCode = 0;
+                }
+            }
+            delete renderer;
+        } else {
+            printf("Could not load trace %s\n", path.c_str());
+        }
+        CloseConsole();
+        return exitCode;
+    }
+    // "--benchmark-culling [objects] [iterations]" times the scalar and SIMD
+    // culling paths.
+    if (arguments && argumentCount >= 1 && wcscmp(arguments[0], L"--benchmark-culling") == 0) {
+        CreateConsole();
+        size_t objectCount = argumentCount >= 2 ? size_t(_wtoi64(arguments[1])) : 1000000;
+        uint32_t iterations = argumentCount >= 3 ? uint32_t(_wtoi(arguments[2])) : 100;
+        LocalFree(arguments);
+
+        benchmarkCulling(objectCount, iterations, &ThreadPool::getShared());
+        CloseConsole();
+        return 0;
+    }
+    // "--benchmark-dispatch [calls] [iterations]" compares the cost of a call
+    // through the loader with one through the dispatch table.
+    if (arguments && argumentCount >= 1 && wcscmp(arguments[0], L"--benchmark-dispatch") == 0) {
+        CreateConsole();
+        uint32_t callCount = argumentCount >= 2 ? uint32_t(_wtoi(arguments[1])) : 100000;
+        uint32_t iterations = argumentCount >= 3 ? uint32_t(_wtoi(arguments[2])) : 100;
+        LocalFree(arguments);
+
+        Renderer* renderer = new Renderer(RendererMode::Headless);
+        benchmarkDispatch(renderer, callCount, iterations);
+        delete renderer;
+        CloseConsole();
+        return 0;
+    }
+    // "--benchmark-mesh [grid size] [iterations]" compares full and quantized
+    // vertices and the cache miss ratio before and after optimization.
+    if (arguments && argumentCount >= 1 && wcscmp(arguments[0], L"--benchmark-mesh") == 0) {
+        CreateConsole();
+        uint32_t gridSize = argumentCount >= 2 ? uint32_t(_wtoi(arguments[1])) : 512;
+        uint32_t iterations = argumentCount >= 3 ? uint32_t(_wtoi(arguments[2])) : 100;
+        LocalFree(arguments);
+
+        Renderer* renderer = new Renderer(RendererMode::Headless);
+        benchmarkMesh(renderer, gridSize, iterations);
+        delete renderer;
+        CloseConsole();
+        return 0;
+    }
+    // "--batch [jobs]" spreads small GPU jobs over every device and prints
+    // the throughput and how the work was split.
+    if (arguments && argumentCount >= 1 && wcscmp(arguments[0], L"--batch") == 0) {
+        CreateConsole();
+        uint32_t jobCount = argumentCount >= 2 ? uint32_t(_wtoi(arguments[1])) : 1000;
+        LocalFree(arguments);
+
+        Renderer* renderer = new Renderer(RendererMode::Headless);
+        benchmarkMultiDevice(renderer, jobCount);
+        delete renderer;
+        CloseConsole();
+        return 0;
+    }
+    LocalFree(arguments);
 
 #ifdef _DEBUG
     CreateConsole();
@@ -42,6 +133,15 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
     Renderer* renderer = new Renderer();
     renderer->openWindow(800, 600, "Vulkan");
+    renderer->setTargetFrameRate(60.0);
+    // F12 writes the next frame to a trace that "--replay" can time.
+    uint32_t captureCount = 0;
+    renderer->setInputHandler([renderer, captureCount](const InputEvent& event) mutable {
+        if (event.type == InputEventType::KeyDown && event.a == VK_F12) {
+            renderer->captureNextFrame("frame" + std::to_string(captureCount++) + ".trace");
+        }
+    });
+    renderer->startRenderThread();
     while (renderer->run()) {}
     delete renderer;
 